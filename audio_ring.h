@@ -0,0 +1,70 @@
+// audio_ring.h -- the half/full double buffer between a front-end's render
+// loop and its output ISR, shared by the Teensy builds (main2.c, main3.c).
+//
+// The ISR drains one half while the main loop renders the other. full[h] is
+// set by the main loop once half h is rendered and cleared by the ISR once it
+// has passed on the last sample of it. Both sides run on one core, so a
+// compiler barrier before the flag is enough to publish the samples.
+#ifndef AUDIO_RING_H
+#define AUDIO_RING_H
+
+#include <stdint.h>
+
+#define AUDIO_RING_SIZE 256
+#define AUDIO_RING_HALF (AUDIO_RING_SIZE / 2)  // Samples rendered per render call.
+
+// Called by audio_ring_fill after rendering each half, before publishing it;
+// a host emulator hooks it to run the interrupts that would have preempted
+// the render.
+#ifndef AUDIO_RING_HALF_RENDERED
+#define AUDIO_RING_HALF_RENDERED() ((void)0)
+#endif
+
+typedef struct {
+    uint16_t samples[AUDIO_RING_SIZE];  // Ordered by full[]; see audio_ring_fill.
+    volatile uint32_t index;      // Next sample the ISR passes on; only the ISR writes it.
+    volatile uint8_t full[2];
+    volatile uint32_t underruns;  // Drains that found their half not yet rendered.
+    uint32_t fill_half;           // Next half the main loop renders.
+} audio_ring;
+
+// Main loop: render a whole half for every half the ISR has handed back.
+static inline void audio_ring_fill(audio_ring* ring, void (*render)(uint16_t* out, uint32_t frames)) {
+    while (!ring->full[ring->fill_half]) {
+        render(&ring->samples[ring->fill_half * AUDIO_RING_HALF], AUDIO_RING_HALF);
+        AUDIO_RING_HALF_RENDERED();
+        __asm__ volatile ("" ::: "memory");  // Samples land before the flag.
+        ring->full[ring->fill_half] = 1;
+        ring->fill_half ^= 1;
+    }
+}
+
+// ISR: pass up to n samples to put, in order, handing each finished half
+// back to the main loop. Returns how many were passed. If the main loop is
+// behind it stops short rather than replay stale samples, counts an
+// underrun, and resumes from the same sample next time.
+static inline uint32_t audio_ring_drain(audio_ring* ring, uint32_t n, void (*put)(uint16_t sample)) {
+    uint32_t index = ring->index, done = 0;
+    while (done < n) {
+        const uint32_t half = index / AUDIO_RING_HALF;
+        if (!ring->full[half]) {
+            ring->underruns++;
+            break;
+        }
+
+        uint32_t m = AUDIO_RING_HALF - index % AUDIO_RING_HALF;
+        if (m > n - done) m = n - done;
+        for (uint32_t i = 0; i < m; i++) put(ring->samples[index + i]);
+        index += m;
+        done += m;
+
+        if (index % AUDIO_RING_HALF == 0) {
+            ring->full[half] = 0;  // Hand the half back to the main loop.
+            index %= AUDIO_RING_SIZE;
+        }
+    }
+    ring->index = index;
+    return done;
+}
+
+#endif // AUDIO_RING_H
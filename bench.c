@@ -0,0 +1,99 @@
+// bench.c -- microbenchmarks for the render path in synth_engine.c.
+//
+// Renders a fixed amount of audio for every combination of waveform and voice
+// count and reports ns per output frame, realtime multiple and cycles per
+// voice-sample. synth_render splits every call into RENDER_BLOCK_SIZE frames,
+// so each call here renders exactly one internal block; the block size is
+// fixed at build time (-DRENDER_BLOCK_SIZE=N on both files to measure
+// another). Build and run with `./nob bench`; pass a kernel name (or set
+// SYNTH_KERNEL) to benchmark a specific voice kernel, or "mcp4921" for the
+// fixed-point DAC path.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+    #define BENCH_RDTSC
+#endif
+
+#include "synth_engine.h"
+
+#define BENCH_SECONDS 2.0f  // Audio rendered per measurement.
+#define BENCH_REPEATS 5     // Best of this many runs is reported.
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static inline uint64_t bench_cycles(void) {
+#if defined(BENCH_RDTSC)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static void bench_init(synth_params* params, WaveType wave, int voices) {
+    srand(1);  // Same detune for every case.
+    synth_init(params, wave, voices);
+}
+
+// Render one internal block with the float path (stereo) or the fixed-point
+// MCP4921 path (mono words).
+static void bench_render(synth_params* params, int fixed) {
+    static float out[RENDER_BLOCK_SIZE * 2];
+    static uint16_t words[RENDER_BLOCK_SIZE];
+    if (fixed) synth_render_mcp4921(params, words, RENDER_BLOCK_SIZE);
+    else       synth_render(params, out, RENDER_BLOCK_SIZE, 2);
+}
+
+static void bench_case(WaveType wave, int voices, int fixed) {
+    static synth_params params;
+    const uint64_t frames = (uint64_t)(BENCH_SECONDS * SAMPLE_RATE) / RENDER_BLOCK_SIZE * RENDER_BLOCK_SIZE;
+    double best_time = 0.0;
+    uint64_t best_cycles = 0;
+
+    bench_init(&params, wave, voices);
+    bench_render(&params, fixed);  // Warm caches and the tables.
+
+    for (int r = 0; r < BENCH_REPEATS; r++) {
+        const double t0 = now_seconds();
+        const uint64_t c0 = bench_cycles();
+        for (uint64_t done = 0; done < frames; done += RENDER_BLOCK_SIZE) {
+            bench_render(&params, fixed);
+        }
+        const uint64_t cycles = bench_cycles() - c0;
+        const double time = now_seconds() - t0;
+        if (r == 0 || time < best_time) {
+            best_time = time;
+            best_cycles = cycles;
+        }
+    }
+
+    const double ns_per_frame = best_time * 1e9 / (double)frames;
+    static const char* names[] = { "sin", "saw", "squ", "tri", "tbl" };
+    printf("%-5s %7d %12.2f %12.1f", names[wave],
+            voices, ns_per_frame, (double)frames / SAMPLE_RATE / best_time);
+    if (best_cycles != 0) printf(" %14.3f\n", (double)best_cycles / ((double)frames * (double)voices));
+    else                  printf(" %14s\n", "n/a");
+}
+
+int main(int argc, char** argv) {
+    static const WaveType waves[] = { WAVE_SIN, WAVE_SAW, WAVE_SQU, WAVE_TRI, WAVE_TABLE };
+    static const int voice_counts[] = { 1, 8, 64, 256 };
+
+    const char* force = argc > 1 ? argv[1] : getenv("SYNTH_KERNEL");
+    const int fixed = force != NULL && strcmp(force, "mcp4921") == 0;
+    const char* kernel = fixed ? "mcp4921 (fixed point)" : select_voice_kernels(force);
+
+    printf("kernel: %s  block: %d frames  audio per case: %.1f s  best of %d\n",
+           kernel, RENDER_BLOCK_SIZE, BENCH_SECONDS, BENCH_REPEATS);
+    printf("%-5s %7s %12s %12s %14s\n", "wave", "voices", "ns/sample", "x realtime", "cycles/voice");
+    for (size_t w = 0; w < sizeof(waves) / sizeof(waves[0]); w++)
+        for (size_t v = 0; v < sizeof(voice_counts) / sizeof(voice_counts[0]); v++)
+            bench_case(waves[w], voice_counts[v], fixed);
+    return 0;
+}
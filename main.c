@@ -1,7 +1,11 @@
+#ifndef EMBEDDED
+#define _GNU_SOURCE  // pthread_setaffinity_np, CPU_SET.
+#endif
 #include <stdio.h>
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #ifdef EMBEDDED
     #define MA_NO_RUNTIME_LINKING
@@ -16,53 +20,169 @@
     #endif
 #else
 #include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <unistd.h>
 #include <termios.h>
-#include <sys/ioctl.h>
+#include <poll.h>
+#include <stdarg.h>
 #endif
 
 #define MINIAUDIO_IMPLEMENTATION
 #include "miniaudio.h"
 
-#define TABLE_SIZE 1024
-#define SAMPLE_RATE 48000.0f
-#define MAX_VOICES 5
+#include "synth_engine.h"
+
+static inline ma_uint64 now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ma_uint64)ts.tv_sec * 1000000000u + (ma_uint64)ts.tv_nsec;
+}
+
+#define TIMING_BUCKETS 256  // Four sub-buckets per power of two of nanoseconds.
+
+// Callback timing, written only by the audio thread and read by any other
+// thread. Every field has a single writer, so updates are plain relaxed
+// stores; a reader may see one callback's fields half-applied, which is fine
+// for statistics.
+typedef struct {
+    ma_uint64 callbacks;
+    ma_uint64 xruns;        // Callbacks that took longer than their deadline.
+    ma_uint64 busy_ns;      // Sum of callback durations.
+    ma_uint64 budget_ns;    // Sum of callback deadlines.
+    ma_uint64 min_ns;
+    ma_uint64 max_ns;
+    ma_uint32 peak_load;    // Highest duration/deadline seen, in 1/1000.
+    ma_uint32 active_voices; // Voices sounding after the last callback.
+    ma_uint32 hist[TIMING_BUCKETS];
+} callback_timing;
+
+// Snapshot of callback_timing for display.
+typedef struct {
+    ma_uint64 callbacks;
+    ma_uint64 xruns;
+    double min_us, mean_us, p99_us, max_us;
+    double load;            // busy/budget over the whole run, in percent.
+    double peak_load;       // In percent.
+} timing_summary;
+
+#define TIMING_STORE(field, value) __atomic_store_n(&(field), (value), __ATOMIC_RELAXED)
+#define TIMING_LOAD(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+
+static inline ma_uint32 timing_bucket(ma_uint64 ns) {
+    if (ns < 4) return (ma_uint32)ns;
+    const int e = 63 - __builtin_clzll(ns);
+    return (ma_uint32)(e * 4 + ((ns >> (e - 2)) & 3));
+}
 
-// Precompute a sine lookup table for one cycle.
-float SINELUT[TABLE_SIZE];
-void init_sineLUT() {
-    for (int i = 0; i < TABLE_SIZE; i++) {
-        SINELUT[i] = sinf((2.0f * 3.14159265f * i) / TABLE_SIZE);
+// Largest duration that falls into bucket b.
+static ma_uint64 timing_bucket_limit(ma_uint32 b) {
+    if (b < 8) return b;
+    const int e = (int)(b / 4);
+    return ((ma_uint64)(4 + b % 4 + 1) << (e - 2)) - 1;
+}
+
+// Record one callback that took duration_ns against a deadline of deadline_ns.
+// Audio thread only; costs a handful of loads and stores.
+static void timing_record(callback_timing* t, ma_uint64 duration_ns, ma_uint64 deadline_ns) {
+    const ma_uint64 count = t->callbacks;
+    const ma_uint32 load = (ma_uint32)(duration_ns * 1000 / deadline_ns);
+    const ma_uint32 b = timing_bucket(duration_ns);
+
+    TIMING_STORE(t->hist[b], t->hist[b] + 1);
+    TIMING_STORE(t->busy_ns, t->busy_ns + duration_ns);
+    TIMING_STORE(t->budget_ns, t->budget_ns + deadline_ns);
+    if (count == 0 || duration_ns < t->min_ns) TIMING_STORE(t->min_ns, duration_ns);
+    if (duration_ns > t->max_ns) TIMING_STORE(t->max_ns, duration_ns);
+    if (load > t->peak_load) TIMING_STORE(t->peak_load, load);
+    if (duration_ns > deadline_ns) TIMING_STORE(t->xruns, t->xruns + 1);
+    TIMING_STORE(t->callbacks, count + 1);
+}
+
+// Summarise t from a thread other than the audio thread. p99 is the upper
+// edge of its histogram bucket, so it is accurate to within 25%.
+void timing_read(const callback_timing* t, timing_summary* s) {
+    const ma_uint64 busy = TIMING_LOAD(t->busy_ns);
+    const ma_uint64 budget = TIMING_LOAD(t->budget_ns);
+    ma_uint64 total = 0;
+    ma_uint32 hist[TIMING_BUCKETS];
+    for (ma_uint32 b = 0; b < TIMING_BUCKETS; b++) {
+        hist[b] = TIMING_LOAD(t->hist[b]);
+        total += hist[b];
+    }
+
+    s->callbacks = TIMING_LOAD(t->callbacks);
+    s->xruns = TIMING_LOAD(t->xruns);
+    s->min_us = (double)TIMING_LOAD(t->min_ns) * 1e-3;
+    s->max_us = (double)TIMING_LOAD(t->max_ns) * 1e-3;
+    s->mean_us = total > 0 ? (double)busy / (double)total * 1e-3 : 0.0;
+    s->load = budget > 0 ? (double)busy * 100.0 / (double)budget : 0.0;
+    s->peak_load = (double)TIMING_LOAD(t->peak_load) * 0.1;
+    s->p99_us = 0.0;
+
+    const ma_uint64 rank = total - total / 100;
+    ma_uint64 seen = 0;
+    for (ma_uint32 b = 0; b < TIMING_BUCKETS && total > 0; b++) {
+        seen += hist[b];
+        if (seen >= rank) {
+            s->p99_us = (double)timing_bucket_limit(b) * 1e-3;
+            break;
+        }
     }
 }
 
-// Define waveform types.
-typedef enum {
-    WAVE_SIN,
-    WAVE_SAW,
-    WAVE_SQU
-} WaveType;
+#ifndef EMBEDDED
+#define RT_PRIORITY 70  // SCHED_FIFO priority for the callback, in the range audio servers use.
+
+// Opt-in real-time setup (--realtime, --cpu). main fills in the request before
+// the device starts. The first callback applies it to whichever thread the
+// backend calls from, since miniaudio does not expose that thread, and then
+// publishes the outcome through applied.
+typedef struct {
+    int enabled;         // Ask for SCHED_FIFO and lock memory.
+    int cpu;             // Core to pin the callback thread to, or -1.
+    int mlock_error;     // errno from mlockall, set by main.
+    int sched_error;     // Error from pthread_setschedparam, 0 on success.
+    int affinity_error;  // Error from pthread_setaffinity_np, 0 on success.
+    int applied;         // Set by the audio thread once the fields above are final.
+} realtime_request;
+
+// One-line account of the real-time request for the UI and the exit summary.
+static void realtime_describe(const realtime_request* rt, char* buf, size_t size) {
+    if (!rt->enabled && rt->cpu < 0) {
+        snprintf(buf, size, "off (--realtime to enable)");
+        return;
+    }
+    if (!__atomic_load_n(&rt->applied, __ATOMIC_ACQUIRE)) {
+        snprintf(buf, size, "waiting for the first callback");
+        return;
+    }
+    int len = 0;
+    if (rt->enabled) {
+        len += rt->sched_error == 0
+            ? snprintf(buf + len, size - len, "SCHED_FIFO %d", RT_PRIORITY)
+            : snprintf(buf + len, size - len, "SCHED_FIFO denied (%s)", strerror(rt->sched_error));
+        len += rt->mlock_error == 0
+            ? snprintf(buf + len, size - len, ", memory locked")
+            : snprintf(buf + len, size - len, ", mlock denied (%s)", strerror(rt->mlock_error));
+    }
+    if (rt->cpu >= 0) {
+        if (rt->affinity_error == 0) snprintf(buf + len, size - len, "%spinned to cpu %d", len > 0 ? ", " : "", rt->cpu);
+        else snprintf(buf + len, size - len, "%scpu %d pin failed (%s)", len > 0 ? ", " : "", rt->cpu, strerror(rt->affinity_error));
+    }
+}
+#endif
 
-// Structure to hold oscillator state.
+// Everything the audio callback touches: the engine plus the host's own
+// instrumentation of it.
 typedef struct {
-    float base_freq;
-    float freqs[MAX_VOICES];
-    float phase;          // Current phase [0.0, 1.0).
-    float phases[MAX_VOICES];
-    WaveType wave_type;
-    int num_voices;
-} oscillator;
-
-typedef struct { 
-    float depth;        
-    float base_freq;     
-    float phase;         
-    WaveType wave_type;   
-} lfo_filter;
-
-typedef struct { 
-    oscillator osc;
-    lfo_filter lfo;
-} synth_params;
+    synth_params synth;
+    callback_timing timing;
+#ifndef EMBEDDED
+    realtime_request rt;
+#endif
+} synth_host;
 
 #ifndef EMBEDDED
 // For Linux: set terminal to non-canonical mode for immediate keypress processing.
@@ -78,200 +198,484 @@ void set_conio_terminal_mode(void) {
     tcsetattr(0, TCSANOW, &new_termios);
     atexit(reset_terminal_mode);
 }
-int kbhit(void) {
-    int bytesWaiting;
-    ioctl(0, FIONREAD, &bytesWaiting);
-    return bytesWaiting;
-}
 int getch(void) {
     int r;
     unsigned char c;
-    if ((r = (int)read(0, &c, sizeof(c))) < 0) {
-        return r;
+    if ((r = (int)read(0, &c, sizeof(c))) <= 0) {
+        return -1;  // Error or end of input.
     } else {
         return c;
     }
 }
 
+#define UI_LINES 20
+#define UI_LINE_LEN 160
+#define UI_REFRESH_MS 250  // Redraw interval when no key is pressed.
+
+// What is currently on the terminal, one entry per row, so a redraw only
+// emits the rows whose text changed.
+typedef struct {
+    char lines[UI_LINES][UI_LINE_LEN];
+} ui_screen;
+
+static void ui_clear(ui_screen* scr) {
+    printf("\033[2J");
+    for (int row = 0; row < UI_LINES; row++) scr->lines[row][0] = '\0';
+}
+
+static void ui_line(ui_screen* scr, int row, const char* fmt, ...) {
+    char line[UI_LINE_LEN];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    if (strcmp(line, scr->lines[row]) == 0) return;
+    printf("\033[%d;1H%s\033[K", row + 1, line);
+    memcpy(scr->lines[row], line, sizeof(line));
+}
+
+// Notes on the number keys: a C major scale from middle C.
+#define NUM_KEY_NOTES 8
+static const int KEY_NOTES[NUM_KEY_NOTES] = { 60, 62, 64, 65, 67, 69, 71, 72 };
+static const char* KEY_NOTE_NAMES[NUM_KEY_NOTES] = { " C4", " D4", " E4", " F4", " G4", " A4", " B4", " C5" };
+
+// Control-side handle: the queue into the audio thread plus a private copy of
+// the parameters it has sent, used for display and for computing new values.
+typedef struct {
+    cmd_queue* cmds;
+    const callback_timing* timing;
+    const realtime_request* rt;
+    synth_params view;
+    int held[NUM_KEY_NOTES + 1];  // Notes toggled on from the keyboard; last is the drone.
+    ma_uint32 period_frames;      // Device buffering as negotiated at startup.
+    ma_uint32 periods;
+    ma_uint32 sample_rate;
+} synth_control;
+
+// Time for a sample to pass through every device period.
+static double control_latency_ms(const synth_control* ctl) {
+    if (ctl->sample_rate == 0) return 0.0;
+    return (double)ctl->period_frames * ctl->periods * 1000.0 / ctl->sample_rate;
+}
+
+#define LOAD_WINDOW_NS 250000000u  // Audio time averaged into each load reading.
+
+// Load meter for the UI, fed from the audio thread's callback_timing.
+typedef struct {
+    ma_uint64 busy_ns;      // Totals at the start of the current window.
+    ma_uint64 budget_ns;
+    double load;            // Percent of the deadline used over the last window.
+} load_meter;
+
+// Close the window once it spans LOAD_WINDOW_NS of audio.
+static void load_meter_update(load_meter* m, const callback_timing* t) {
+    const ma_uint64 busy = TIMING_LOAD(t->busy_ns);
+    const ma_uint64 budget = TIMING_LOAD(t->budget_ns);
+    if (budget - m->budget_ns < LOAD_WINDOW_NS) return;
+    m->load = (double)(busy - m->busy_ns) * 100.0 / (double)(budget - m->budget_ns);
+    m->busy_ns = busy;
+    m->budget_ns = budget;
+}
+
+// Queue a change and mirror it into the control view if it was accepted.
+static void send_cmd(synth_control* ctl, synth_cmd_type type, float value) {
+    synth_cmd cmd = { type, value };
+    if (!cmd_queue_push(ctl->cmds, cmd)) return;
+    switch (type) {
+        case CMD_OSC_WAVE:   ctl->view.osc.wave_type = (WaveType)(int)value; break;
+        case CMD_OSC_FREQ:   ctl->view.osc.base_freq = value; break;
+        case CMD_LFO_WAVE:   ctl->view.lfo.wave_type = (WaveType)(int)value; break;
+        case CMD_LFO_FREQ:   ctl->view.lfo.base_freq = value; break;
+        case CMD_LFO_DEPTH:  ctl->view.lfo.depth = value; break;
+        case CMD_NUM_VOICES: ctl->view.osc.num_voices = (int)value; break;
+        case CMD_NOTE_ON:    break;
+        case CMD_NOTE_OFF:   break;
+        case CMD_ENV_ATTACK:  ctl->view.osc.env.attack = value; break;
+        case CMD_ENV_DECAY:   ctl->view.osc.env.decay = value; break;
+        case CMD_ENV_SUSTAIN: ctl->view.osc.env.sustain = value; break;
+        case CMD_ENV_RELEASE: ctl->view.osc.env.release = value; break;
+    }
+}
+
+// Envelope times step geometrically so both ends of the range stay usable.
+static float env_time_step(float seconds, float factor) {
+    seconds *= factor;
+    if (seconds < ENV_MIN_TIME) seconds = ENV_MIN_TIME;
+    if (seconds > ENV_MAX_TIME) seconds = ENV_MAX_TIME;
+    return seconds;
+}
+
 void* input_thread(void* arg) {
-    synth_params* params = (synth_params*)arg;
+    synth_control* ctl = (synth_control*)arg;
+    const synth_params* params = &ctl->view;
+    load_meter meter = { 0, 0, 0.0 };
+    timing_summary timing;
+    static ui_screen screen;
+    struct pollfd input = { 0, POLLIN, 0 };
     set_conio_terminal_mode();
-    printf("Press 'j' to increase LFO base_freq by 0.1 Hz, 'k' to decrease by 0.1 Hz\n");
+    ui_clear(&screen);
     while (1) {
-        if (kbhit()) {
-            int ch = getch();
+        load_meter_update(&meter, ctl->timing);
+        timing_read(ctl->timing, &timing);
+
+        // Sleep until a key arrives or the meter is due for a refresh.
+        int ch = -1;
+        if (poll(&input, 1, UI_REFRESH_MS) > 0 && (input.revents & (POLLIN | POLLHUP))) {
+            ch = getch();
+            if (ch < 0) input.fd = -1;  // stdin closed; keep refreshing the meter.
+        }
+        if (ch >= 0) {
             if (ch == 'j') {
-                params->lfo.base_freq += 0.1f;
+                send_cmd(ctl, CMD_LFO_FREQ, params->lfo.base_freq + 0.1f);
             } else if (ch == 'k') {
-                params->lfo.base_freq -= 0.1f;
-                if (params->lfo.base_freq < 0.0f) params->lfo.base_freq = 0.0f;
+                float freq = params->lfo.base_freq - 0.1f;
+                if (freq < 0.0f) freq = 0.0f;
+                send_cmd(ctl, CMD_LFO_FREQ, freq);
             } else if (ch == 'g') { 
-                params->osc.base_freq += 10.0;
-                for (int k = 0; k < MAX_VOICES; k ++) { 
-                    if (params->osc.freqs[k] > 600.0) params->osc.freqs[k] = 600.0f;
-                    params->osc.freqs[k] += 10.0f;
-                }
-                if (params->osc.base_freq > 600.0) params->osc.base_freq = 600.0f;
+                float freq = params->osc.base_freq + 10.0f;
+                if (freq > 600.0f) freq = 600.0f;
+                send_cmd(ctl, CMD_OSC_FREQ, freq);
             } else if (ch == 'h') {
-                params->osc.base_freq -= 10.0;
-                for (int k = 0; k < MAX_VOICES; k ++) { 
-                    if (params->osc.freqs[k] < 50.0) params->osc.freqs[k] = 50.0f;
-                    params->osc.freqs[k] -= 10.0f;
-                }
-                if (params->osc.base_freq < 50.0) params->osc.base_freq = 50.0f;
+                float freq = params->osc.base_freq - 10.0f;
+                if (freq < 50.0f) freq = 50.0f;
+                send_cmd(ctl, CMD_OSC_FREQ, freq);
             } else if (ch == 'd') { 
-                params->lfo.depth += 0.05f;
-                if (params->lfo.depth > 2.0f) params->lfo.depth = 2.0f;
+                float depth = params->lfo.depth + 0.05f;
+                if (depth > 2.0f) depth = 2.0f;
+                send_cmd(ctl, CMD_LFO_DEPTH, depth);
             } else if (ch == 'f') {
-                params->lfo.depth -= 0.05f;
-                if (params->lfo.depth < 0.0f) params->lfo.depth = 0.0f;
+                float depth = params->lfo.depth - 0.05f;
+                if (depth < 0.0f) depth = 0.0f;
+                send_cmd(ctl, CMD_LFO_DEPTH, depth);
             } else if (ch == 'w') {  
-                params->osc.wave_type = (params->osc.wave_type + 1) % 3;
+                send_cmd(ctl, CMD_OSC_WAVE, (float)((params->osc.wave_type + 1) % NUM_OSC_WAVES));
             } else if (ch == 'e') { 
-                params->lfo.wave_type = (params->lfo.wave_type + 1) % 3;
+                send_cmd(ctl, CMD_LFO_WAVE, (float)((params->lfo.wave_type + 1) % NUM_LFO_WAVES));
             } else if (ch == 'b') {  
-                if (params->osc.num_voices > 1) params->osc.num_voices -= 1;
+                if (params->osc.num_voices > 1) send_cmd(ctl, CMD_NUM_VOICES, (float)(params->osc.num_voices - 1));
             } else if (ch == 'n') { 
-                if (params->osc.num_voices < MAX_VOICES) params->osc.num_voices += 1;
+                if (params->osc.num_voices < MAX_VOICES) send_cmd(ctl, CMD_NUM_VOICES, (float)(params->osc.num_voices + 1));
+            } else if (ch == 'B') {
+                int voices = params->osc.num_voices - 16;
+                if (voices < 1) voices = 1;
+                send_cmd(ctl, CMD_NUM_VOICES, (float)voices);
+            } else if (ch == 'N') {
+                int voices = params->osc.num_voices + 16;
+                if (voices > MAX_VOICES) voices = MAX_VOICES;
+                send_cmd(ctl, CMD_NUM_VOICES, (float)voices);
+            } else if (ch == 'a' || ch == 'A') {
+                send_cmd(ctl, CMD_ENV_ATTACK, env_time_step(params->osc.env.attack, ch == 'A' ? 1.25f : 0.8f));
+            } else if (ch == 'z' || ch == 'Z') {
+                send_cmd(ctl, CMD_ENV_DECAY, env_time_step(params->osc.env.decay, ch == 'Z' ? 1.25f : 0.8f));
+            } else if (ch == 'r' || ch == 'R') {
+                send_cmd(ctl, CMD_ENV_RELEASE, env_time_step(params->osc.env.release, ch == 'R' ? 1.25f : 0.8f));
+            } else if (ch == 's') {
+                float sustain = params->osc.env.sustain - 0.05f;
+                if (sustain < 0.0f) sustain = 0.0f;
+                send_cmd(ctl, CMD_ENV_SUSTAIN, sustain);
+            } else if (ch == 'S') {
+                float sustain = params->osc.env.sustain + 0.05f;
+                if (sustain > 1.0f) sustain = 1.0f;
+                send_cmd(ctl, CMD_ENV_SUSTAIN, sustain);
+            } else if (ch >= '0' && ch < '1' + NUM_KEY_NOTES) {
+                // Terminals report no key releases, so note keys toggle.
+                const int key = ch == '0' ? NUM_KEY_NOTES : ch - '1';
+                const int note = ch == '0' ? NOTE_DRONE : KEY_NOTES[key];
+                ctl->held[key] = !ctl->held[key];
+                send_cmd(ctl, ctl->held[key] ? CMD_NOTE_ON : CMD_NOTE_OFF, (float)note);
             }
         }
 
-        // Clear screen
-        printf("\033[2J\033[H");
-
-        // Print parameters with controls
-        printf("C-EMBEDDED-SYNTH PARAMETERS\n");
-        printf("---------------------------\n");
-        printf("Oscillator Waveform:   %-10s     (w: cycle through waveforms)\n", 
-                params->osc.wave_type == WAVE_SIN ? "Sine" : 
-                params->osc.wave_type == WAVE_SAW ? "Sawtooth" : "Square");
-        printf("Oscillator Frequency:  %6.2f Hz      (g: increase, h: decrease)\n", params->osc.base_freq);
-        printf("--------------------------------------------------------------------\n");
-        printf("LFO Waveform:          %-10s     (e: cycle through waveforms)\n",
-                params->lfo.wave_type == WAVE_SIN ? "Sine" : 
-                params->lfo.wave_type == WAVE_SAW ? "Sawtooth" : "Square");
-        printf("LFO Frequency:        %6.2f Hz       (j: increase, k: decrease)\n", params->lfo.base_freq);
-        printf("LFO Depth:           %6.2f           (d: increase, f: decrease)\n", params->lfo.depth);
-        printf("--------------------------------------------------------------------\n");
-        printf("Voices:           %6d             (n: increase, b: decrease)\n", params->osc.num_voices);
-
-        usleep(10000); // Sleep 10ms to reduce CPU load.
+        // Print parameters with controls; only changed rows reach the terminal.
+        ui_line(&screen, 0, "C-EMBEDDED-SYNTH PARAMETERS");
+        ui_line(&screen, 1, "---------------------------");
+        ui_line(&screen, 2, "Oscillator Waveform:   %-10s     (w: cycle through waveforms)", 
+                wave_name(params->osc.wave_type));
+        ui_line(&screen, 3, "Oscillator Frequency:  %6.2f Hz      (g: increase, h: decrease)", params->osc.base_freq);
+        ui_line(&screen, 4, "--------------------------------------------------------------------");
+        ui_line(&screen, 5, "LFO Waveform:          %-10s     (e: cycle through waveforms)",
+                wave_name(params->lfo.wave_type));
+        ui_line(&screen, 6, "LFO Frequency:        %6.2f Hz       (j: increase, k: decrease)", params->lfo.base_freq);
+        ui_line(&screen, 7, "LFO Depth:           %6.2f           (d: increase, f: decrease)", params->lfo.depth);
+        ui_line(&screen, 8, "--------------------------------------------------------------------");
+        ui_line(&screen, 9, "Unison Voices:    %6d             (n/N: increase, b/B: decrease)", params->osc.num_voices);
+        char notes[UI_LINE_LEN] = "";
+        if (ctl->held[NUM_KEY_NOTES]) strcat(notes, " drone");
+        for (int key = 0; key < NUM_KEY_NOTES; key++) {
+            if (ctl->held[key]) strcat(notes, KEY_NOTE_NAMES[key]);
+        }
+        ui_line(&screen, 10, "Notes:%-28s (0: drone, 1-8: C4..C5)", notes);
+        ui_line(&screen, 11, "Active Voices:    %6u / %d", (unsigned)TIMING_LOAD(ctl->timing->active_voices), MAX_VOICES);
+        ui_line(&screen, 12, "Envelope:  A %6.3f s  D %6.3f s  S %4.2f  R %6.3f s",
+                params->osc.env.attack, params->osc.env.decay, params->osc.env.sustain, params->osc.env.release);
+        ui_line(&screen, 13, "           (a/A, z/Z, s/S, r/R: lower/raise attack, decay, sustain, release)");
+        ui_line(&screen, 14, "--------------------------------------------------------------------");
+        ui_line(&screen, 15, "Device Buffer:    %u x %u frames at %u Hz, %.1f ms latency",
+                ctl->periods, ctl->period_frames, ctl->sample_rate, control_latency_ms(ctl));
+        char rt[UI_LINE_LEN];
+        realtime_describe(ctl->rt, rt, sizeof(rt));
+        ui_line(&screen, 16, "Realtime:         %s", rt);
+        ui_line(&screen, 17, "DSP Load:             %5.1f %%   peak %5.1f %%   xruns: %llu", meter.load,
+                timing.peak_load, (unsigned long long)timing.xruns);
+        ui_line(&screen, 18, "Callback Time:    min %7.1f  mean %7.1f  p99 %7.1f  max %7.1f us",
+                timing.min_us, timing.mean_us, timing.p99_us, timing.max_us);
+
+        fflush(stdout);
     }
     return NULL;
 }
 #endif
 
-// Callback function that generates audio data.
+#ifndef EMBEDDED
+// Raise and pin the calling thread as requested. Runs once, from the first
+// callback; the system calls cost a few microseconds against one deadline.
+static void realtime_thread_setup(realtime_request* rt) {
+    int sched_error = 0, affinity_error = 0;
+    if (rt->enabled) {
+        struct sched_param sp = { .sched_priority = RT_PRIORITY };
+        sched_error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+    }
+    if (rt->cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(rt->cpu, &set);
+        affinity_error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+    rt->sched_error = sched_error;
+    rt->affinity_error = affinity_error;
+    __atomic_store_n(&rt->applied, 1, __ATOMIC_RELEASE);
+}
+#endif
+
+// Callback function that generates audio data. Each call is timed against its
+// deadline, the time it takes to play frameCount frames.
 void data_callback(ma_device* pDevice, void* pOutput, const void* pInput, ma_uint32 frameCount) {
-    synth_params* params = (synth_params*)pDevice->pUserData;
-    oscillator* osc = &params->osc;
-    lfo_filter* lfo = &params->lfo;
-    float* out = (float*)pOutput;
-    
-    for (ma_uint32 i = 0; i < frameCount; i++) {
-        float sample = 0.0f;
-        float lfoValue = 0.0f;
-        
-        // Calculate LFO value based on current phase and waveform.
-        switch (lfo->wave_type) {
-            case WAVE_SIN: {
-                int lfoIndex = (int)(lfo->phase * TABLE_SIZE) % TABLE_SIZE;
-                lfoValue = SINELUT[lfoIndex];
-                break;
-            }
-            case WAVE_SAW:
-                lfoValue = 2.0f * lfo->phase - 1.0f;
-                break;
-            case WAVE_SQU:
-                lfoValue = (lfo->phase < 0.5f) ? -1.0f : 1.0f;
-                break;
-            default: {
-                int lfoIndex = (int)(lfo->phase * TABLE_SIZE) % TABLE_SIZE;
-                lfoValue = SINELUT[lfoIndex];
-                break;
-            }
-        }
-        
-        // main
-        float frequencyMod = 1.0f + (lfoValue * lfo->depth);
-        // voices
-        float currentVoiceIncrements[MAX_VOICES];
-        for (int k = 0; k < osc->num_voices; k ++) { 
-            currentVoiceIncrements[k] = osc->freqs[k] / SAMPLE_RATE * frequencyMod;
+    (void)pInput;
+    synth_host* host = (synth_host*)pDevice->pUserData;
+#ifndef EMBEDDED
+    if (!host->rt.applied) realtime_thread_setup(&host->rt);
+#endif
+    const ma_uint64 start = now_ns();
+    synth_render(&host->synth, (float*)pOutput, frameCount, 2);
+    const ma_uint64 deadline = (ma_uint64)frameCount * 1000000000u / pDevice->sampleRate;
+    timing_record(&host->timing, now_ns() - start, deadline);
+    TIMING_STORE(host->timing.active_voices, (ma_uint32)host->synth.osc.active);
+}
+
+#ifndef EMBEDDED
+static double now_seconds(void) {
+    return (double)now_ns() * 1e-9;
+}
+
+#define OFFLINE_CHUNK_FRAMES 4096
+#define MAX_RENDER_SECONDS 86400.0f  // A day; keeps the frame count well inside ma_uint64.
+
+// Headless mode: drive synth_render as fast as possible and write the result
+// to path, as a float WAV if the name ends in ".wav" and as raw interleaved
+// f32 otherwise. Reports how much faster than realtime the render ran; the
+// time spent writing the file is reported separately.
+int render_offline(synth_params* params, const char* kernel, const char* path, float seconds) {
+    static float buffer[OFFLINE_CHUNK_FRAMES * 2];
+    const size_t len = strlen(path);
+    const int wav = len >= 4 && strcmp(path + len - 4, ".wav") == 0;
+    ma_encoder encoder;
+    FILE* raw = NULL;
+
+    if (wav) {
+        ma_encoder_config config = ma_encoder_config_init(ma_encoding_format_wav, ma_format_f32, 2, (ma_uint32)SAMPLE_RATE);
+        if (ma_encoder_init_file(path, &config, &encoder) != MA_SUCCESS) {
+            fprintf(stderr, "Failed to open %s for writing.\n", path);
+            return -1;
         }
-        
-        // Generate oscillator output using the modulated phase increment.
-        switch (osc->wave_type) {
-            case WAVE_SIN: {
-                for (int k = 0; k < osc->num_voices; k ++) { 
-                    int index = (int)(osc->phases[k] * TABLE_SIZE) % TABLE_SIZE;
-                    sample += SINELUT[index];
-                }
-                sample /= (float)osc->num_voices;
-                break;
-            }
-            case WAVE_SAW:
-                for (int k = 0; k < osc->num_voices; k ++) { 
-                    sample += (2.0f * osc->phases[k] - 1.0f);
-                }
-                sample /= (float)osc->num_voices;
-                break;
-            case WAVE_SQU:
-                for (int k = 0; k < osc->num_voices; k ++) { 
-                    sample += (osc->phase < 0.5f) ? -1.0f: 1.0f;
-                }
-                sample /= (float)osc->num_voices;
-                break;
-            default: {
-                for (int k = 0; k < osc->num_voices; k ++) { 
-                    int index = (int)(osc->phases[k] * TABLE_SIZE) % TABLE_SIZE;
-                    sample += SINELUT[index];
-                }
-                sample /= (float)osc->num_voices;
-                break;
-            }
+    } else {
+        raw = fopen(path, "wb");
+        if (raw == NULL) {
+            fprintf(stderr, "Failed to open %s for writing.\n", path);
+            return -1;
         }
-        
-        // Write stereo sample.
-        *out++ = sample;
-        *out++ = sample;
-
-        //voices
-        for (int k = 0; k < osc->num_voices; k ++) { 
-            osc->phases[k] += currentVoiceIncrements[k];
-            if (osc->phases[k] >= 1.0f)
-                osc->phases[k] -= 1.0f;
+    }
+
+    ma_uint64 remaining = (ma_uint64)(seconds * SAMPLE_RATE);
+    const ma_uint64 total = remaining;
+    double render_time = 0.0;
+    const double start = now_seconds();
+    int result = 0;
+
+    while (remaining > 0) {
+        ma_uint32 n = remaining < OFFLINE_CHUNK_FRAMES ? (ma_uint32)remaining : OFFLINE_CHUNK_FRAMES;
+        const double t0 = now_seconds();
+        synth_render(params, buffer, n, 2);
+        render_time += now_seconds() - t0;
+
+        if (wav ? ma_encoder_write_pcm_frames(&encoder, buffer, n, NULL) != MA_SUCCESS
+                : fwrite(buffer, sizeof(float) * 2, n, raw) != n) {
+            fprintf(stderr, "Failed to write %s.\n", path);
+            result = -1;
+            break;
         }
+        remaining -= n;
+    }
+
+    if (wav) ma_encoder_uninit(&encoder);
+    else     fclose(raw);
 
-        // Update LFO phase.
-        lfo->phase += lfo->base_freq / SAMPLE_RATE;
-        if (lfo->phase >= 1.0f)
-            lfo->phase -= 1.0f;
+    const double wall = now_seconds() - start;
+    const double audio = (double)(total - remaining) / SAMPLE_RATE;
+    printf("Rendered %.2f s of audio (%d voices, kernel %s) to %s\n", audio, params->osc.active, kernel, path);
+    printf("Render: %.3f s (%.1fx realtime)  Total with I/O: %.3f s (%.1fx realtime)\n",
+            render_time, render_time > 0.0 ? audio / render_time : 0.0,
+            wall, wall > 0.0 ? audio / wall : 0.0);
+    return result;
+}
+#endif
+
+#ifndef EMBEDDED
+// Touch every page of [data, data + size) so the first access from the audio
+// thread does not fault. Writes back what it reads, as a read alone would map
+// untouched anonymous pages to the shared zero page and fault again on write.
+static void prefault(void* data, size_t size) {
+    volatile unsigned char* p = (volatile unsigned char*)data;
+    const long page = sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < size; i += (size_t)page) p[i] = p[i];
+    if (size > 0) p[size - 1] = p[size - 1];
+}
+
+// Lock the process in memory and fault in the synth state and tables;
+// prefaulting still helps when the lock is refused. Call after ma_device_init,
+// so the audio thread's stack is already mapped and gets locked, and before
+// the device starts. MCL_FUTURE is left out: under an RLIMIT_MEMLOCK it would
+// make later allocations such as the input thread's stack fail.
+static void realtime_lock_memory(synth_host* host) {
+    host->rt.mlock_error = mlockall(MCL_CURRENT) == 0 ? 0 : errno;
+    prefault(host, sizeof(*host));
+    synth_touch_tables();
+}
+
+// Device buffering requested on the command line. Zero fields leave the
+// choice to miniaudio's defaults for the profile.
+typedef struct {
+    ma_performance_profile profile;
+    ma_uint32 period_frames;
+    ma_uint32 periods;
+    ma_bool8 fixed_callback;  // Have miniaudio rebuffer into exact period-sized callbacks.
+} latency_config;
+
+#define LOW_LATENCY_PERIOD_FRAMES 96  // 2 ms at 48 kHz.
+#define LOW_LATENCY_PERIODS 2
+
+// The low-latency preset also lets callbacks follow the backend's own size:
+// synth_render takes any frame count, and miniaudio's fixed-size rebuffering
+// would add a period of delay.
+static int parse_latency(const char* name, latency_config* lat) {
+    if (strcmp(name, "low") == 0) {
+        lat->profile = ma_performance_profile_low_latency;
+        lat->period_frames = LOW_LATENCY_PERIOD_FRAMES;
+        lat->periods = LOW_LATENCY_PERIODS;
+        lat->fixed_callback = MA_FALSE;
+    } else if (strcmp(name, "conservative") == 0) {
+        lat->profile = ma_performance_profile_conservative;
+        lat->fixed_callback = MA_TRUE;
+    } else {
+        return 0;
     }
+    return 1;
 }
 
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [--render FILE] [--seconds N] [--voices N] [--wave sin|saw|squ|tri|tbl]\n", prog);
+    fprintf(stderr, "          [--latency low|conservative] [--period FRAMES] [--periods N] [--realtime] [--cpu N]\n");
+    fprintf(stderr, "  --render FILE  render offline to FILE (.wav, otherwise raw f32) instead of playing\n");
+    fprintf(stderr, "  --latency      low: %d-frame periods for live play; conservative: large periods, fewer wakeups\n",
+            LOW_LATENCY_PERIOD_FRAMES);
+    fprintf(stderr, "  --period, --periods  override the device period size and count\n");
+    fprintf(stderr, "  --realtime     run the audio callback SCHED_FIFO and lock memory (needs CAP_SYS_NICE or an rtprio limit)\n");
+    fprintf(stderr, "  --cpu N        pin the audio callback thread to core N\n");
+}
+
+static int parse_wave(const char* name, WaveType* wave) {
+    if (strcmp(name, "sin") == 0) *wave = WAVE_SIN;
+    else if (strcmp(name, "saw") == 0) *wave = WAVE_SAW;
+    else if (strcmp(name, "squ") == 0) *wave = WAVE_SQU;
+    else if (strcmp(name, "tri") == 0) *wave = WAVE_TRI;
+    else if (strcmp(name, "tbl") == 0) *wave = WAVE_TABLE;
+    else return 0;
+    return 1;
+}
+#endif
+
 #ifdef EMBEDDED
 int main(void) {
 #else
-int main() {
+int main(int argc, char** argv) {
+    const char* render_path = NULL;
+    float render_seconds = 10.0f;
+    int num_voices = 3;
+    WaveType wave = WAVE_SIN;
+    latency_config latency = { ma_performance_profile_low_latency, 0, 0, MA_TRUE };
+    int realtime = 0;
+    int cpu = -1;
+    for (int i = 1; i < argc; i++) {
+        const int has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--render") == 0 && has_value) {
+            render_path = argv[++i];
+        } else if (strcmp(argv[i], "--seconds") == 0 && has_value) {
+            render_seconds = strtof(argv[++i], NULL);
+            // Also rules out NaN, which fails every comparison.
+            if (!(render_seconds > 0.0f && render_seconds <= MAX_RENDER_SECONDS)) {
+                fprintf(stderr, "--seconds must be between 0 and %.0f.\n", MAX_RENDER_SECONDS);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--voices") == 0 && has_value) {
+            num_voices = atoi(argv[++i]);
+            if (num_voices < 1) num_voices = 1;
+            if (num_voices > MAX_VOICES) num_voices = MAX_VOICES;
+        } else if (strcmp(argv[i], "--wave") == 0 && has_value && parse_wave(argv[i + 1], &wave)) {
+            i++;
+        } else if (strcmp(argv[i], "--latency") == 0 && has_value && parse_latency(argv[i + 1], &latency)) {
+            i++;
+        } else if (strcmp(argv[i], "--period") == 0 && has_value) {
+            latency.period_frames = (ma_uint32)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--periods") == 0 && has_value) {
+            latency.periods = (ma_uint32)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--realtime") == 0) {
+            realtime = 1;
+        } else if (strcmp(argv[i], "--cpu") == 0 && has_value) {
+            cpu = atoi(argv[++i]);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
 #endif
-    init_sineLUT();
+    const char* kernel = select_voice_kernels(getenv("SYNTH_KERNEL"));
     
     // Initialize synth parameters.
-    synth_params params;
-    params.osc.base_freq = 240.0f;
-    params.osc.phase = 0.0f;
-    params.osc.wave_type = WAVE_SIN;
-    params.osc.num_voices = 3;
-    for (int k = 0; k < MAX_VOICES; k++) { 
-        params.osc.freqs[k] = params.osc.base_freq * (0.99f + ((float)rand() / RAND_MAX) * 0.01f); // random variation between 90% and 110% of base base_freq
-        params.osc.phases[k] = 0.0f;
-    } 
-    
-    params.lfo.depth = 0.2f;
-    params.lfo.base_freq = 10.0f;
-    params.lfo.phase = 0.0f;
-    params.lfo.wave_type = WAVE_SAW;  // You can change this to WAVE_SIN or WAVE_SQU.
+    static synth_host host;
+#ifdef EMBEDDED
+    synth_init(&host.synth, WAVE_SIN, 3);
+#else
+    synth_init(&host.synth, wave, num_voices);
+#endif
+    memset(&host.timing, 0, sizeof(host.timing));
+
+#ifndef EMBEDDED
+    if (render_path != NULL) {
+        return render_offline(&host.synth, kernel, render_path, render_seconds) == 0 ? 0 : 1;
+    }
+
+    host.rt.enabled = realtime;
+    host.rt.cpu = cpu;
+    host.rt.mlock_error = 0;
+    host.rt.applied = 0;
+
+    // Snapshot for the input thread, taken before the audio thread owns host.
+    static synth_control control;
+    control.cmds = &host.synth.cmds;
+    control.timing = &host.timing;
+    control.rt = &host.rt;
+    control.view = host.synth;
+    control.held[NUM_KEY_NOTES] = 1;  // The drone started above.
+#endif
     
     // Configure miniaudio.
     ma_device device;
@@ -280,12 +684,25 @@ int main() {
     config.playback.channels = 2;
     config.sampleRate        = 48000;
     config.dataCallback      = data_callback;
-    config.pUserData         = &params;
+    config.pUserData         = &host;
+#ifndef EMBEDDED
+    config.performanceProfile   = latency.profile;
+    config.periodSizeInFrames   = latency.period_frames;
+    config.periods              = latency.periods;
+    config.noFixedSizedCallback = !latency.fixed_callback;
+#endif
     
     if (ma_device_init(NULL, &config, &device) != MA_SUCCESS) {
         fprintf(stderr, "Failed to initialize audio device.\n");
         return -1;
     }
+#ifndef EMBEDDED
+    // What the backend actually granted; requests are only hints.
+    control.period_frames = device.playback.internalPeriodSizeInFrames;
+    control.periods = device.playback.internalPeriods;
+    control.sample_rate = device.playback.internalSampleRate;
+    if (realtime) realtime_lock_memory(&host);
+#endif
     if (ma_device_start(&device) != MA_SUCCESS) {
         fprintf(stderr, "Failed to start audio device.\n");
         ma_device_uninit(&device);
@@ -295,12 +712,27 @@ int main() {
 #ifndef EMBEDDED
     // On Linux, start the input thread to adjust LFO base_freq.
     pthread_t thread;
-    if (pthread_create(&thread, NULL, input_thread, &params) != 0) {
+    if (pthread_create(&thread, NULL, input_thread, &control) != 0) {
         fprintf(stderr, "Error creating input thread.\n");
         return -1;
     }
     sleep(100);
     pthread_cancel(thread);
+    pthread_join(thread, NULL);
+    reset_terminal_mode();
+    printf("\033[%d;1H", UI_LINES + 1);
+
+    timing_summary timing;
+    timing_read(&host.timing, &timing);
+    printf("\nCallbacks: %llu  xruns: %llu  load: %.1f%% (peak %.1f%%)\n",
+            (unsigned long long)timing.callbacks, (unsigned long long)timing.xruns, timing.load, timing.peak_load);
+    printf("Callback time: min %.1f us  mean %.1f us  p99 %.1f us  max %.1f us\n",
+            timing.min_us, timing.mean_us, timing.p99_us, timing.max_us);
+    printf("Device buffer: %u x %u frames at %u Hz, %.1f ms output latency\n",
+            control.periods, control.period_frames, control.sample_rate, control_latency_ms(&control));
+    char rt[UI_LINE_LEN];
+    realtime_describe(&host.rt, rt, sizeof(rt));
+    printf("Realtime: %s\n", rt);
 #else
     while (1) {
         embedded_delay_ms(10);
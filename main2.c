@@ -5,148 +5,77 @@
 #include <Arduino.h>  // For Teensy/Arduino functions
 #include "imxrt.h"  // Include Teensy 4.1 hardware definitions
 
-#define TABLE_SIZE 256
-#define SAMPLE_RATE 48000
+#include "synth_engine.h"
+#include "audio_ring.h"
+
 #define PWM_PIN 9     // Teensy 4.1 PWM-capable pin (adjust as needed)
 #define PWM_FREQ SAMPLE_RATE
 #define PWM_RESOLUTION 8  // 8-bit resolution (0-255)
 
-void loop() {
-    // Main loop stays free for other tasks
-}
+#define PIT_CLOCK 24000000  // The core clocks the PIT from the 24 MHz PERCLK.
 
+// Synth engine state, shared with the audio path.
+static synth_params params;
 
-// Precompute sine lookup table
-float SINELUT[TABLE_SIZE];
-void init_sineLUT() {
-    for (int i = 0; i < TABLE_SIZE; i++) {
-        SINELUT[i] = sinf((2.0f * 3.14159265f * i) / TABLE_SIZE);
-    }
+static audio_ring ring;  // PWM duty values; see audio_ring.h.
+
+// Engine output [-1, 1] to the PWM range, clamped since the voice mix can
+// exceed full scale.
+static uint8_t pwm_duty(float sample) {
+    if (sample > 1.0f) sample = 1.0f;
+    if (sample < -1.0f) sample = -1.0f;
+    return (uint8_t)((sample + 1.0f) * 127.5f);  // Convert [-1, 1] to [0, 255]
 }
 
-// Waveform types
-typedef enum {
-    WAVE_SIN,
-    WAVE_SAW,
-    WAVE_SQU
-} WaveType;
-
-// Oscillator structure
-typedef struct {
-    float frequency;      // Frequency in Hz
-    float phase;          // Current phase [0.0, 1.0)
-    WaveType wave_type;
-} oscillator;
-
-// LFO structure
-typedef struct {
-    float depth;         // Modulation depth (0.0 - 1.0)
-    float frequency;     // LFO frequency in Hz
-    float phase;         // Current phase [0.0, 1.0)
-    WaveType wave_type;
-} lfo_filter;
-
-// Synth parameters
-typedef struct {
-    oscillator osc;
-    lfo_filter lfo;
-} synth_params;
-
-// Generate a single sample
-float generate_sample(synth_params* params) {
-    oscillator* osc = &params->osc;
-    lfo_filter* lfo = &params->lfo;
-
-    // Calculate LFO value
-    float lfoValue = 0.0f;
-    switch (lfo->wave_type) {
-        case WAVE_SIN: {
-            int lfoIndex = (int)(lfo->phase * TABLE_SIZE) % TABLE_SIZE;
-            lfoValue = SINELUT[lfoIndex];
-            break;
-        }
-        case WAVE_SAW:
-            lfoValue = 2.0f * lfo->phase - 1.0f;
-            break;
-        case WAVE_SQU:
-            lfoValue = (lfo->phase < 0.5f) ? -1.0f : 1.0f;
-            break;
-    }
+static void render_duties(uint16_t* out, uint32_t frames) {
+    float block[AUDIO_RING_HALF];
+    synth_render(&params, block, frames, 1);
+    for (uint32_t i = 0; i < frames; i++) out[i] = pwm_duty(block[i]);
+}
 
-    // Apply LFO to frequency modulation
-    float frequencyMod = 1.0f + (lfoValue * lfo->depth);
-    float phaseIncrement = (osc->frequency / SAMPLE_RATE) * frequencyMod;
-
-    // Generate oscillator output
-    float sample = 0.0f;
-    switch (osc->wave_type) {
-        case WAVE_SIN: {
-            int index = (int)(osc->phase * TABLE_SIZE) % TABLE_SIZE;
-            float fundamental = SINELUT[index];
-            float secondHarmonic = SINELUT[(2 * index) % TABLE_SIZE];
-            float thirdHarmonic = SINELUT[(3 * index) % TABLE_SIZE];
-            sample = (fundamental + secondHarmonic + thirdHarmonic) / 3.0f;
-            break;
-        }
-        case WAVE_SAW:
-            sample = 2.0f * osc->phase - 1.0f;
-            break;
-        case WAVE_SQU:
-            sample = (osc->phase < 0.5f) ? -1.0f : 1.0f;
-            break;
-    }
+// Render a whole half for every half the ISR has handed back.
+static void audio_fill() {
+    audio_ring_fill(&ring, render_duties);
+}
 
-    // Update phases
-    osc->phase += phaseIncrement;
-    if (osc->phase >= 1.0f) osc->phase -= 1.0f;
-    lfo->phase += lfo->frequency / SAMPLE_RATE;
-    if (lfo->phase >= 1.0f) lfo->phase -= 1.0f;
+static inline void pwm_put(uint16_t duty) { analogWrite(PWM_PIN, duty); }
 
-    // Scale sample to PWM range (0 to 255)
-    return (sample + 1.0f) * 127.5f;  // Convert [-1, 1] to [0, 255]
-}
+// Timer interrupt: play one sample per PIT tick. If loop() has not rendered
+// it yet the PWM keeps the last duty and the same sample is retried next tick.
+void pit_isr() {
+    // Clear interrupt flag
+    PIT_TFLG0 = PIT_TFLG_TIF;
 
-// Timer interrupt callback
-volatile float nextSample = 0.0f;
+    audio_ring_drain(&ring, 1, pwm_put);
+}
 
 void setup() {
+    synth_init(&params, WAVE_SIN, 3);
+
+    analogWriteResolution(PWM_RESOLUTION);
+    analogWriteFrequency(PWM_PIN, PWM_FREQ);
+    audio_fill();  // Prime both halves before the first interrupt.
+
     // Enable clock for the PIT
     CCM_CCGR1 |= CCM_CCGR1_PIT(CCM_CCGR_ON);
 
-    // Load value for a 1 ms interval (adjust as needed)
-    PIT_CHANNEL[0].LDVAL = (F_CPU / 1000) - 1;
+    // One interrupt per output sample
+    PIT_LDVAL0 = (PIT_CLOCK / (uint32_t)SAMPLE_RATE) - 1;
 
     // Enable timer and interrupt
+    attachInterruptVector(IRQ_PIT, pit_isr);
     PIT_MCR = 0;
     PIT_TCTRL0 = PIT_TCTRL_TIE | PIT_TCTRL_TEN;
     NVIC_ENABLE_IRQ(IRQ_PIT);
 }
 
-void pit_isr() {
-    // Clear interrupt flag
-    PIT_TFLG0 = PIT_TFLG_TIF;
-
-    // Your buffer update logic here
-}
-
 void loop() {
-    // Synth parameters
-    static synth_params params = {
-        .osc = {240.0f, 0.0f, WAVE_SIN},
-        .lfo = {0.2f, 10.0f, 0.0f, WAVE_SAW}
-    };
-
-    // Generate next sample
-    noInterrupts();  // Protect shared variable
-    nextSample = generate_sample(&params);
-    interrupts();
-
-    delay(10);  // Adjust as needed for control updates
+    // The PIT ISR plays the buffer; refill the half it drained.
+    audio_fill();
 }
 
 int main() {
     setup();
-    init_sineLUT();
     while (1) {
         loop();
     }
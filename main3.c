@@ -1,80 +1,108 @@
 #include <stdint.h>
-#include "imxrt.h"
-
-#define PIT_BASE 0xFFFFF300
-#define PIT_MCR  (*(volatile uint32_t *)(PIT_BASE + 0x00))
-#define PIT_LDVAL0  (*(volatile uint32_t *)(PIT_BASE + 0x100))
-#define PIT_CVAL0  (*(volatile uint32_t *)(PIT_BASE + 0x104))
-#define PIT_TCTRL0 (*(volatile uint32_t *)(PIT_BASE + 0x108))
-#define PIT_TFLG0  (*(volatile uint32_t *)(PIT_BASE + 0x10C))
+#include "synth_engine.h"
 
-#define LPSPI4_BASE 0x403A8000
-#define LPSPI4_CR    (*(volatile uint32_t *)(LPSPI4_BASE + 0x10))
-#define LPSPI4_TCR   (*(volatile uint32_t *)(LPSPI4_BASE + 0x08))
-#define LPSPI4_TDR   (*(volatile uint32_t *)(LPSPI4_BASE + 0x40))
-#define LPSPI4_SR    (*(volatile uint32_t *)(LPSPI4_BASE + 0x14))
-#define LPSPI4_CFGR1 (*(volatile uint32_t *)(LPSPI4_BASE + 0x0C))
-
-#define IRQ_PIT 22  // PIT Interrupt Request number
-#define AUDIO_BUFFER_SIZE 256
+#ifdef TEENSY_EMU
+// Host build (./nob emu): the registers below are modelled by teensy_emu.c.
+#include "teensy_emu.h"
+#else
+#include "imxrt.h"
 
-volatile uint16_t audio_buffer[AUDIO_BUFFER_SIZE];
-volatile uint32_t buffer_index = 0;
+// Sleep until the next interrupt; the main loop only has work after a tick.
+static inline void wait_for_interrupt(void) { __asm__ volatile ("wfi"); }
+#endif
+#include "audio_ring.h"
+
+#define PIT_CLOCK_HZ 24000000    // The PIT counts the 24 MHz PERCLK.
+#define LPSPI_CLOCK_HZ 96000000  // LPSPI clock root the divider below assumes.
+
+// The TX FIFO paces the DAC. Each SPI frame (chip select, 16 bits, gap) lasts
+// exactly one sample period and the MCP4921 latches on chip-select rise (LDAC
+// tied low), so the SPI clock is the sample clock. 96 MHz / 8 is a 12 MHz
+// functional clock: 250 clocks per 48 kHz sample, SCK = 12 MHz / 10.
+#define SPI_PRESCALE 3    // Functional clock / 2^3.
+#define SPI_SCKDIV 8      // SCK period = SCKDIV + 2 clocks.
+#define SPI_FRAME_BITS 16
+#define SPI_FRAME_CLOCKS ((LPSPI_CLOCK_HZ >> SPI_PRESCALE) / (uint32_t)SAMPLE_RATE)
+// Pad the frame to one sample: PCSSCK + 1 and SCKPCS + 1 (both 0) around the
+// bits, then DBT + 2 between frames.
+#define SPI_DBT (SPI_FRAME_CLOCKS - SPI_FRAME_BITS * (SPI_SCKDIV + 2) - 1 - 1 - 2)
+#define SPI_FIFO_DEPTH 16
+
+// The PIT only tops the FIFO up, once per SPI_BATCH samples, so the FIFO holds
+// two ticks of output and the ISR never waits on the SPI.
+#define SPI_BATCH 8
+
+#define SYNTH_WAVE WAVE_SIN
+#define SYNTH_VOICES 3
+
+static audio_ring ring;  // MCP4921 command words; see audio_ring.h.
+static synth_params synth;
 
 // SPI Initialization
 void spi_init() {
     CCM_CCGR1 |= CCM_CCGR1_LPSPI4(CCM_CCGR_ON);  // Enable LPSPI4 clock
-    IOMUXC_SW_MUX_CTL_PAD_GPIO_B0_01 = 2; // Set Pin 11 (B0_01) to LPSPI4_MOSI
+    IOMUXC_SW_MUX_CTL_PAD_GPIO_B0_00 = 3;  // Pin 10: LPSPI4_PCS0 (DAC chip select)
+    IOMUXC_SW_MUX_CTL_PAD_GPIO_B0_02 = 3;  // Pin 11: LPSPI4_SDO
+    IOMUXC_SW_MUX_CTL_PAD_GPIO_B0_03 = 3;  // Pin 13: LPSPI4_SCK
 
     LPSPI4_CR = 0;  // Disable SPI before configuring
-    LPSPI4_TCR = (11 << 27) |  // 16-bit transfer (for DAC)
-                 (1 << 24) |   // Master mode
-                 (0 << 22) |   // Clock polarity 0
-                 (0 << 21) |   // Clock phase 0
-                 (0 << 18) |   // Prescaler divide by 1
-                 (0 << 16);    // Frame size 16 bits
-
-    LPSPI4_CFGR1 = (1 << 0);  // Enable master mode
-    LPSPI4_CR = (1 << 0);  // Enable LPSPI4
+    LPSPI4_CFGR1 = LPSPI_CFGR1_MASTER;
+    LPSPI4_CCR = LPSPI_CCR_SCKPCS(0) | LPSPI_CCR_PCSSCK(0) |
+                 LPSPI_CCR_DBT(SPI_DBT) | LPSPI_CCR_SCKDIV(SPI_SCKDIV);
+    LPSPI4_TCR = LPSPI_TCR_PRESCALE(SPI_PRESCALE) |
+                 LPSPI_TCR_PCS(0) |
+                 LPSPI_TCR_RXMSK |  // Nothing comes back from the DAC.
+                 LPSPI_TCR_FRAMESZ(SPI_FRAME_BITS - 1);  // Mode 0, MSB first
+    LPSPI4_CR = LPSPI_CR_MEN;  // Enable LPSPI4
 }
 
-// SPI Send Function (Send 16-bit Sample to DAC)
-void spi_send(uint16_t data) {
-    while (!(LPSPI4_SR & (1 << 1)));  // Wait until TX FIFO is empty
-    LPSPI4_TDR = data;  // Send data to DAC
-}
+static inline void spi_put(uint16_t word) { LPSPI4_TDR = word; }
 
-// PIT ISR: Send Sample from Audio Buffer
+// PIT ISR: top the TX FIFO up from the ring. The FIFO drains one word per
+// sample period by itself; writing only into free slots means the ISR never
+// polls the SPI. If the main loop is behind the FIFO is left short and the
+// DAC holds its last code.
 void pit_isr(void) {
-    PIT_TFLG0 = 1;  // Clear PIT interrupt flag
+    PIT_TFLG0 = PIT_TFLG_TIF;  // Clear PIT interrupt flag
+
+    const uint32_t room = SPI_FIFO_DEPTH - (LPSPI4_FSR & LPSPI_FSR_TXCOUNT(0x1F));
+    audio_ring_drain(&ring, room, spi_put);
+}
 
-    // Send audio sample to DAC via SPI... sawtooth wave
-    spi_send(audio_buffer[buffer_index]);
+// Fixed-point render straight to MCP4921 command words.
+static void render_words(uint16_t* out, uint32_t frames) {
+    synth_render_mcp4921(&synth, out, frames);
+}
 
-    // Increment buffer index, wrap around
-    buffer_index = (buffer_index + 1) % AUDIO_BUFFER_SIZE;
+// Render a whole half for every half the ISR has handed back.
+void audio_fill(void) {
+    audio_ring_fill(&ring, render_words);
 }
 
 // PIT Timer Initialization
 void pit_init(uint32_t frequency) {
+    CCM_CCGR1 |= CCM_CCGR1_PIT(CCM_CCGR_ON);  // Enable PIT clock
     PIT_MCR = 0x00;  // Enable PIT module
 
-    uint32_t load_value = (48000000 / frequency) - 1; // Assuming 48MHz system clock
-    PIT_LDVAL0 = load_value;
+    PIT_LDVAL0 = (PIT_CLOCK_HZ / frequency) - 1;
 
-    PIT_TCTRL0 = 0x3;  // Enable Timer and Interrupt
+    PIT_TCTRL0 = PIT_TCTRL_TIE | PIT_TCTRL_TEN;  // Enable Timer and Interrupt
 }
 
 // Main Function
 int main(void) {
     spi_init();   // Initialize SPI for DAC communication
-    pit_init(8000);  // Initialize PIT at 8kHz for audio output
+    synth_init(&synth, SYNTH_WAVE, SYNTH_VOICES);
+    audio_fill();  // Prime both halves before the first interrupt.
+    pit_init((uint32_t)SAMPLE_RATE / SPI_BATCH);  // One FIFO top-up per SPI_BATCH samples
 
     // Enable PIT interrupt in NVIC
-    *(volatile uint32_t *)(0xE000E100) |= (1 << IRQ_PIT);
+    NVIC_ENABLE_IRQ(IRQ_PIT);
 
     while (1) {
-        // The PIT ISR will automatically send audio data to the DAC
+        // The PIT ISR feeds the SPI FIFO; refill the half it drained.
+        audio_fill();
+        wait_for_interrupt();
     }
 
     return 0;
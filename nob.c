@@ -1,35 +1,164 @@
 // nob.c
 #include <stdio.h>
 #include <string.h>
+#include <math.h>
+// The table generator needs libm.
+#define NOB_REBUILD_URSELF(binary_path, source_path) "cc", "-o", binary_path, source_path, "-lm"
 #define NOB_IMPLEMENTATION
 #include "nob.h"
 
+#define TABLES_PATH "synth_tables.h"
+#define SINE_TABLE_BITS 8
+#define SINE_TABLE_SIZE (1 << SINE_TABLE_BITS)
+#define WT_BITS 10
+#define WT_SIZE (1 << WT_BITS)
+#define WT_LEVELS 10
+
+// Write `count` floats as the body of a C array initializer.
+static void write_floats(FILE* f, const double* v, int count)
+{
+    for (int i = 0; i < count; i++) {
+        fprintf(f, "%s%.9g,", (i % 8 == 0) ? "\n    " : " ", v[i]);
+    }
+}
+
+// Write `count` values times scale as the body of an int16_t array
+// initializer, rounded and saturated.
+static void write_q15(FILE* f, const double* v, int count, double scale)
+{
+    for (int i = 0; i < count; i++) {
+        double q = round(v[i] * scale);
+        if (q > 32767.0) q = 32767.0;
+        if (q < -32768.0) q = -32768.0;
+        fprintf(f, "%s%d,", (i % 12 == 0) ? "\n    " : " ", (int)q);
+    }
+}
+
+// Generate the lookup tables the synth reads, so they are const data (flash on
+// the Teensy) instead of being computed into RAM at startup.
+static bool generate_tables(const char* path)
+{
+    FILE* f = fopen(path, "w");
+    if (f == NULL) {
+        nob_log(NOB_ERROR, "Could not write %s", path);
+        return false;
+    }
+
+    fprintf(f, "// %s -- generated by nob.c, do not edit.\n", path);
+    fprintf(f, "#ifndef SYNTH_TABLES_H\n#define SYNTH_TABLES_H\n\n#include <stdint.h>\n\n");
+    fprintf(f, "// On the Teensy keep tables in flash rather than copying them to DTCM.\n");
+    fprintf(f, "#ifndef SYNTH_ROM\n");
+    fprintf(f, "    #if defined(__IMXRT1062__)\n");
+    fprintf(f, "        #define SYNTH_ROM __attribute__((section(\".progmem\")))\n");
+    fprintf(f, "    #else\n");
+    fprintf(f, "        #define SYNTH_ROM\n");
+    fprintf(f, "    #endif\n");
+    fprintf(f, "#endif\n\n");
+    fprintf(f, "#define SINE_TABLE_BITS %d\n", SINE_TABLE_BITS);
+    fprintf(f, "#define SINE_TABLE_SIZE %d\n", SINE_TABLE_SIZE);
+    fprintf(f, "#define WT_BITS %d\n", WT_BITS);
+    fprintf(f, "#define WT_SIZE %d\n", WT_SIZE);
+    fprintf(f, "#define WT_LEVELS %d\n\n", WT_LEVELS);
+
+    // One sine cycle. The extra entry repeats the first so interpolation can
+    // read table[i + 1] without wrapping.
+    static double sine[WT_SIZE + 1];
+    for (int i = 0; i <= SINE_TABLE_SIZE; i++) sine[i] = sin(2.0 * M_PI * i / SINE_TABLE_SIZE);
+    fprintf(f, "static const float SINELUT[SINE_TABLE_SIZE + 1] SYNTH_ROM = {");
+    write_floats(f, sine, SINE_TABLE_SIZE + 1);
+    fprintf(f, "\n};\n\n");
+
+    // The same cycle in Q15 for the fixed-point render path.
+    fprintf(f, "static const int16_t SINELUT_Q15[SINE_TABLE_SIZE + 1] SYNTH_ROM = {");
+    write_q15(f, sine, SINE_TABLE_SIZE + 1, 32767.0);
+    fprintf(f, "\n};\n\n");
+
+    // Band-limited sawtooth rising from -1 to 1, -(2/pi) * sum sin(k x) / k,
+    // one mip level per octave. Level l serves phase increments up to
+    // 2^l / WT_SIZE and keeps only the harmonics below Nyquist at that rate.
+    for (int i = 0; i < WT_SIZE; i++) sine[i] = sin(2.0 * M_PI * i / WT_SIZE);
+    static double levels[WT_LEVELS][WT_SIZE + 1];
+    for (int l = 0; l < WT_LEVELS; l++) {
+        int top = (WT_SIZE >> (l + 1)) - 1;
+        if (top < 1) top = 1;
+        for (int i = 0; i < WT_SIZE; i++) {
+            double v = 0.0;
+            for (int k = 1; k <= top; k++) v -= 2.0 / (M_PI * k) * sine[(k * i) & (WT_SIZE - 1)];
+            levels[l][i] = v;
+        }
+        levels[l][WT_SIZE] = levels[l][0];
+    }
+    fprintf(f, "static const float SAW_WAVETABLE[WT_LEVELS][WT_SIZE + 1] SYNTH_ROM = {");
+    for (int l = 0; l < WT_LEVELS; l++) {
+        fprintf(f, "\n  {");
+        write_floats(f, levels[l], WT_SIZE + 1);
+        fprintf(f, "\n  },");
+    }
+    fprintf(f, "\n};\n\n");
+
+    // Q15 copy at half scale: the band-limited ramp overshoots 1 near the wrap.
+    fprintf(f, "#define SAW_WAVETABLE_Q15_SHIFT 1  // Stored value = sample / 2.\n");
+    fprintf(f, "static const int16_t SAW_WAVETABLE_Q15[WT_LEVELS][WT_SIZE + 1] SYNTH_ROM = {");
+    for (int l = 0; l < WT_LEVELS; l++) {
+        fprintf(f, "\n  {");
+        write_q15(f, levels[l], WT_SIZE + 1, 16384.0);
+        fprintf(f, "\n  },");
+    }
+    fprintf(f, "\n};\n\n#endif // SYNTH_TABLES_H\n");
+
+    fclose(f);
+    return true;
+}
+
 int main(int argc, char **argv)
 {
     NOB_GO_REBUILD_URSELF(argc, argv);
 
     if (argc < 2) {
-        fprintf(stderr, "Usage: %s [host|embedded|emb2]\n", argv[0]);
+        fprintf(stderr, "Usage: %s [host|embedded|emb2|bench|emu]\n", argv[0]);
         return 1;
     }
 
+    if (!generate_tables(TABLES_PATH)) return 1;
+
     Nob_Cmd cmd = {0};
 
     if (strcmp(argv[1], "host") == 0) {
-        nob_cmd_append(&cmd, "cc", "-lm", "-o", "main", "main.c");
+        nob_cmd_append(&cmd, "cc", "-O2", "-o", "main", "main.c", "synth_engine.c", "-lm", "-lpthread");
+    }
+    else if (strcmp(argv[1], "bench") == 0) {
+        nob_cmd_append(&cmd, "cc", "-O2", "-o", "bench", "bench.c", "synth_engine.c", "-lm");
+        if (!nob_cmd_run_sync_and_reset(&cmd)) return 1;
+        nob_cmd_append(&cmd, "./bench");
+        for (int i = 2; i < argc; i++) nob_cmd_append(&cmd, argv[i]);
+    }
+    else if (strcmp(argv[1], "emu") == 0) {
+        // main3.c against the emulated PIT and LPSPI4 in teensy_emu.c.
+        nob_cmd_append(&cmd, "cc", "-O2", "-DTEENSY_EMU", "-o", "teensy_emu", "teensy_emu.c", "synth_engine.c", "-lm");
+        if (!nob_cmd_run_sync_and_reset(&cmd)) return 1;
+        nob_cmd_append(&cmd, "./teensy_emu");
+        for (int i = 2; i < argc; i++) nob_cmd_append(&cmd, argv[i]);
     }
     else if (strcmp(argv[1], "embedded") == 0) { 
+        // The engine is C; build it with gcc and link it into the C++ sketch.
+        nob_cmd_append(&cmd, "arm-none-eabi-gcc",
+                "-mcpu=cortex-m7", "-mthumb", "-O2", "-std=gnu11",
+                "-ffunction-sections", "-fdata-sections",
+                "-DEMBEDDED", "-D__IMXRT1062__", "-Wall", "-Wextra",
+                "-c", "-o", "synth_engine.o", "synth_engine.c");
+        if (!nob_cmd_run_sync_and_reset(&cmd)) return 1;
         nob_cmd_append(&cmd, "arm-none-eabi-g++",
                 "-mcpu=cortex-m7", "-mthumb", "-O2", "-std=c++17",
                 "-ffunction-sections", "-fdata-sections",
                 "-DTEENSY", "-DEMBEDDED", "-D__IMXRT1062__", "-DARDUINO", "-DARDUINO_TEENSY40", "-DLAYOUT_US_ENGLISH",
                 "-I/home/evan/tools/cores/teensy4",
                 "-T./teensy41.ld", "-Wall", "-Wextra", "-Wno-unused-function",
-                "-o", "synth.elf", "main2.c" 
+                "-o", "synth.elf", "main2.c", "synth_engine.o", "-lm"
                 );  // Adjust path to Teensy core
     } else if (strcmp(argv[1], "emb2") == 0) { 
         //nob_cmd_append(&cmd, "arm-none-eabi-gcc", "-mcpu=arm7tdmi", "-mthumb",  "-O2",  "-specs=nosys.specs", "-o", "main.elf", "main3.c");
-        nob_cmd_append(&cmd, "arm-none-eabi-gcc", "-mcpu=cortex-m7", "-mthumb", "-mfpu=fpv5-d16", "-mfloat-abi=hard", "-O2", "-w", "-specs=nosys.specs", "-o", "main.elf", "main3.c");
+        nob_cmd_append(&cmd, "arm-none-eabi-gcc", "-mcpu=cortex-m7", "-mthumb", "-mfpu=fpv5-d16", "-mfloat-abi=hard", "-O2", "-w", "-specs=nosys.specs",
+                "-o", "main.elf", "main3.c", "synth_engine.c", "-lm");
     } 
     // working compilation with newlib:
     // arm-none-eabi-gcc -mcpu=arm7tdmi -mthumb -O2 -specs=nosys.specs -o main.elf main3.c
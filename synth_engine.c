@@ -0,0 +1,708 @@
+// synth_engine.c -- the synth engine; see synth_engine.h.
+#include <stdio.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "synth_engine.h"
+
+// Generated by nob.c: SINELUT (one sine cycle) and SAW_WAVETABLE, both const.
+#include "synth_tables.h"
+
+#define TABLE_SIZE SINE_TABLE_SIZE  // Sine table; interpolated, so it can stay small.
+#define TABLE_BITS SINE_TABLE_BITS
+#define VOICE_MAX_LANES 16  // Widest kernel (AVX-512).
+
+// Instruction sets the voice kernel is built for. On x86 every variant is
+// compiled into the binary and one is chosen at startup from cpuid; elsewhere
+// the choice is made at compile time. Cortex-M7 has no NEON, so the Teensy
+// builds use the scalar kernel.
+#define VK_ISA_SCALAR 0
+#define VK_ISA_SSE41  1
+#define VK_ISA_AVX2   2
+#define VK_ISA_AVX512 3
+#define VK_ISA_NEON   4
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <immintrin.h>
+    #define VOICE_KERNEL_X86
+#elif defined(__ARM_NEON)
+    #include <arm_neon.h>
+#endif
+
+// Phases are 32-bit unsigned fractions of a cycle: PHASE_SCALE units per
+// cycle, so an accumulator wraps on its own and never drifts.
+#define PHASE_SCALE 4294967296.0f
+#define PHASE_TO_SIGNED (1.0f / 2147483648.0f)  // Centred phase to [-1, 1).
+#define FRAC_SCALE (1.0f / 16777216.0f)         // 24-bit fraction to [0, 1).
+
+static inline uint32_t phase_inc(float freq) {
+    return (uint32_t)(int64_t)(freq * (PHASE_SCALE / SAMPLE_RATE));
+}
+
+// Sawtooth rising from -1 to 1 over the cycle.
+static inline float phase_saw(uint32_t phase) {
+    return (float)(int32_t)(phase ^ 0x80000000u) * PHASE_TO_SIGNED;
+}
+
+// Phase as a float in [0, 1), from its top 24 bits.
+static inline float phase_unit(uint32_t phase) {
+    return (float)(phase >> 8) * FRAC_SCALE;
+}
+
+// Phase increment in cycles per sample for the band-limited shapes, from an
+// increment in phase units and the LFO multiplier. Past unit depth the
+// multiplier goes negative and the oscillator runs backwards; its edges are
+// then as sharp as at the same forward speed, so the size is |inc * mod|.
+// The residuals need no sign change: running backwards flips each step and
+// the order its samples arrive in, and the two cancel in the residual as a
+// function of phase. Kept away from zero so its reciprocal stays finite.
+static inline float blep_dt(float inc, float mod) {
+    const float dt = fabsf(inc * mod) * (1.0f / PHASE_SCALE);
+    return dt > 1e-7f ? dt : 1e-7f;
+}
+
+// Scalar PolyBLEP sawtooth and square and PolyBLAMP triangle; see voice_kernel.h for the
+// vector versions and the derivation.
+static inline float blep_residual(uint32_t phase, float idt) {
+    const float t = phase_unit(phase);
+    float lo = 1.0f - t * idt, hi = 1.0f - (1.0f - t) * idt;
+    lo = lo > 0.0f ? lo : 0.0f;
+    hi = hi > 0.0f ? hi : 0.0f;
+    return lo * lo - hi * hi;
+}
+
+static inline float blep_saw(uint32_t phase, float idt) {
+    return phase_saw(phase) + blep_residual(phase, idt);
+}
+
+// -1 for the first half of the cycle and +1 for the second: 1.0f with the
+// inverted top phase bit as its sign, so there is no compare.
+static inline float phase_square(uint32_t phase) {
+    union { uint32_t u; float f; } v;
+    v.u = 0x3F800000u | (~phase & 0x80000000u);
+    return v.f;
+}
+
+// The square falls by 2 at the wrap, like the saw, and rises by 2 half a
+// cycle later, so it takes the saw residual at both edges with opposite signs.
+static inline float blep_square(uint32_t phase, float idt) {
+    return phase_square(phase) + blep_residual(phase, idt) - blep_residual(phase + 0x80000000u, idt);
+}
+
+static inline float blamp_tri(uint32_t phase, float dt, float idt) {
+    const float a = fabsf(phase_unit(phase) - 0.5f);
+    float r0 = 1.0f - (0.5f - a) * idt, rh = 1.0f - a * idt;
+    r0 = r0 > 0.0f ? r0 : 0.0f;
+    rh = rh > 0.0f ? rh : 0.0f;
+    return 1.0f - 4.0f * a + dt * (8.0f / 6.0f) * (r0 * r0 * r0 - rh * rh * rh);
+}
+
+// Read a single-cycle table of 2^bits entries (plus guard) with linear
+// interpolation. The top bits of the phase are the index, the next 24 the
+// fraction.
+static inline float table_lookup(const float* table, int bits, uint32_t phase) {
+    const uint32_t i = phase >> (32 - bits);
+    const float frac = (float)((phase << bits) >> 8) * FRAC_SCALE;
+    return table[i] + frac * (table[i + 1] - table[i]);
+}
+
+// The band-limited sawtooth wavetable has one mip level per octave (WT_SIZE
+// samples each). Level l is used for phase increments up to 2^l / WT_SIZE and
+// only holds harmonics that stay below Nyquist at that rate.
+// Mip level for a phase increment in cycles per sample: the first level whose
+// range covers inc.
+static inline int wavetable_level(float inc) {
+    int l = 0;
+    while (l < WT_LEVELS - 1 && inc * (float)WT_SIZE > (float)(1 << l)) l++;
+    return l;
+}
+
+const char* wave_name(WaveType wave) {
+    switch (wave) {
+        case WAVE_SIN:   return "Sine";
+        case WAVE_SAW:   return "Sawtooth";
+        case WAVE_SQU:   return "Square";
+        case WAVE_TRI:   return "Triangle";
+        case WAVE_TABLE: return "Wavetable";
+    }
+    return "?";
+}
+
+// Per-sample coefficient for a curve that covers the distance to its end point
+// in seconds when aimed ratio beyond it.
+static float adsr_coef(float seconds, float ratio) {
+    return expf(-logf((1.0f + ratio) / ratio) / (seconds * SAMPLE_RATE));
+}
+
+static void adsr_set(adsr* env, float attack, float decay, float sustain, float release) {
+    env->attack = attack;
+    env->decay = decay;
+    env->sustain = sustain;
+    env->release = release;
+    env->coef[ENV_ATTACK] = adsr_coef(attack, ENV_ATTACK_RATIO);
+    env->base[ENV_ATTACK] = (1.0f + ENV_ATTACK_RATIO) * (1.0f - env->coef[ENV_ATTACK]);
+    env->coef[ENV_DECAY] = adsr_coef(decay, ENV_DECAY_RATIO);
+    env->base[ENV_DECAY] = (sustain - ENV_DECAY_RATIO) * (1.0f - env->coef[ENV_DECAY]);
+    env->coef[ENV_SUSTAIN] = 1.0f;
+    env->base[ENV_SUSTAIN] = 0.0f;
+    env->coef[ENV_RELEASE] = adsr_coef(release, ENV_DECAY_RATIO);
+    env->base[ENV_RELEASE] = -ENV_DECAY_RATIO * (1.0f - env->coef[ENV_RELEASE]);
+}
+
+static float note_freq(const oscillator* osc, int note) {
+    if (note == NOTE_DRONE) return osc->base_freq;
+    return 440.0f * powf(2.0f, (float)(note - 69) / 12.0f);
+}
+
+// Release voice k by moving the last live voice into its slot.
+static void voice_free(oscillator* osc, int k) {
+    const int last = --osc->active;
+    osc->freqs[k] = osc->freqs[last];
+    osc->phases[k] = osc->phases[last];
+    osc->gains[k] = osc->gains[last];
+    osc->levels[k] = osc->levels[last];
+    osc->stages[k] = osc->stages[last];
+    osc->detunes[k] = osc->detunes[last];
+    osc->notes[k] = osc->notes[last];
+    osc->ages[k] = osc->ages[last];
+}
+
+// Slot to reuse when the pool is full: the quietest voice by current
+// envelope level, and of those the oldest, never one belonging to the note
+// being started (age). Returns -1 if every voice belongs to that note.
+static int voice_steal(const oscillator* osc, uint32_t age) {
+    int best = -1;
+    float best_level = 0.0f;
+    for (int k = 0; k < osc->active; k++) {
+        if (osc->ages[k] == age) continue;
+        const float level = osc->gains[k] * osc->levels[k];
+        if (best < 0 || level < best_level ||
+            (level == best_level && osc->ages[k] < osc->ages[best])) {
+            best = k;
+            best_level = level;
+        }
+    }
+    return best;
+}
+
+// Start a note with num_voices unison voices at the given velocity, stealing
+// voices if the pool is full. Audio thread only; never allocates.
+static void voice_note_on(oscillator* osc, int note, float velocity) {
+    const float freq = note_freq(osc, note);
+    const uint32_t age = ++osc->note_count;
+    for (int u = 0; u < osc->num_voices; u++) {
+        int k = osc->active < MAX_VOICES ? osc->active++ : voice_steal(osc, age);
+        if (k < 0) break;
+        osc->freqs[k] = freq * osc->spread[u];
+        osc->phases[k] = 0;
+        osc->gains[k] = velocity / (float)osc->num_voices;
+        osc->levels[k] = 0.0f;
+        osc->stages[k] = ENV_ATTACK;
+        osc->detunes[k] = osc->spread[u];
+        osc->notes[k] = note;
+        osc->ages[k] = age;
+    }
+}
+
+// Move the note's voices to their release; they are freed once silent.
+static void voice_note_off(oscillator* osc, int note) {
+    for (int k = 0; k < osc->active; k++) {
+        if (osc->notes[k] == note) osc->stages[k] = ENV_RELEASE;
+    }
+}
+
+static int voice_note_held(const oscillator* osc, int note) {
+    for (int k = 0; k < osc->active; k++) {
+        if (osc->notes[k] == note && osc->stages[k] != ENV_RELEASE) return 1;
+    }
+    return 0;
+}
+
+// Stage changes, checked once per block after the kernel has run the
+// envelopes: a finished attack or decay moves on, and a voice that has gone
+// quiet is freed so it stops costing kernel time. That is a released voice,
+// or a held one whose sustain level is silent (sustain 0 ends the note once
+// its decay is over).
+static void voice_env_update(oscillator* osc) {
+    for (int k = osc->active - 1; k >= 0; k--) {
+        switch (osc->stages[k]) {
+            case ENV_ATTACK:
+                if (osc->levels[k] >= 1.0f) {
+                    osc->levels[k] = 1.0f;
+                    osc->stages[k] = ENV_DECAY;
+                }
+                break;
+            case ENV_DECAY:
+                if (osc->levels[k] <= osc->env.sustain) {
+                    osc->levels[k] = osc->env.sustain;
+                    osc->stages[k] = ENV_SUSTAIN;
+                }
+                break;
+            case ENV_SUSTAIN:
+            case ENV_RELEASE:
+                if (osc->levels[k] < ENV_IDLE_LEVEL) voice_free(osc, k);  // Pulls in a voice already checked.
+                break;
+            case ENV_STAGES:
+                break;
+        }
+    }
+}
+
+int cmd_queue_push(cmd_queue* q, synth_cmd cmd) {
+    uint32_t head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    uint32_t tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+    if (head - tail == CMD_QUEUE_SIZE) return 0;
+    q->cmds[head & (CMD_QUEUE_SIZE - 1)] = cmd;
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+static int cmd_queue_pop(cmd_queue* q, synth_cmd* cmd) {
+    uint32_t tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    uint32_t head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+    if (head == tail) return 0;
+    *cmd = q->cmds[tail & (CMD_QUEUE_SIZE - 1)];
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+// Apply every pending command. Called by the audio thread at block boundaries,
+// so a multi-field change such as a frequency shift lands atomically.
+static void apply_cmds(synth_params* params) {
+    synth_cmd cmd;
+    while (cmd_queue_pop(&params->cmds, &cmd)) {
+        switch (cmd.type) {
+            case CMD_OSC_WAVE:
+                params->osc.wave_type = (WaveType)(int)cmd.value;
+                break;
+            case CMD_OSC_FREQ:
+                params->targets.osc_freq = cmd.value;
+                break;
+            case CMD_LFO_WAVE:
+                params->lfo.wave_type = (WaveType)(int)cmd.value;
+                break;
+            case CMD_LFO_FREQ:
+                params->targets.lfo_freq = cmd.value;
+                break;
+            case CMD_LFO_DEPTH:
+                params->targets.lfo_depth = cmd.value;
+                break;
+            case CMD_NUM_VOICES:
+                params->osc.num_voices = (int)cmd.value;
+                if (voice_note_held(&params->osc, NOTE_DRONE)) {
+                    voice_note_off(&params->osc, NOTE_DRONE);
+                    voice_note_on(&params->osc, NOTE_DRONE, DRONE_VELOCITY);
+                }
+                break;
+            case CMD_NOTE_ON:
+                voice_note_on(&params->osc, (int)cmd.value,
+                              (int)cmd.value == NOTE_DRONE ? DRONE_VELOCITY : NOTE_VELOCITY);
+                break;
+            case CMD_NOTE_OFF:
+                voice_note_off(&params->osc, (int)cmd.value);
+                break;
+            case CMD_ENV_ATTACK: {
+                adsr* env = &params->osc.env;
+                adsr_set(env, cmd.value, env->decay, env->sustain, env->release);
+                break;
+            }
+            case CMD_ENV_DECAY: {
+                adsr* env = &params->osc.env;
+                adsr_set(env, env->attack, cmd.value, env->sustain, env->release);
+                break;
+            }
+            case CMD_ENV_SUSTAIN: {
+                adsr* env = &params->osc.env;
+                adsr_set(env, env->attack, env->decay, cmd.value, env->release);
+                break;
+            }
+            case CMD_ENV_RELEASE: {
+                adsr* env = &params->osc.env;
+                adsr_set(env, env->attack, env->decay, env->sustain, cmd.value);
+                break;
+            }
+        }
+    }
+}
+
+// Frequency multiplier for the LFO's current phase.
+static float lfo_eval(const lfo_filter* lfo) {
+    switch (lfo->wave_type) {
+        case WAVE_SAW: return 1.0f + phase_saw(lfo->phase) * lfo->depth;
+        case WAVE_SQU: return 1.0f + ((lfo->phase < 0x80000000u) ? -lfo->depth : lfo->depth);
+        case WAVE_SIN:
+        default:       return 1.0f + table_lookup(SINELUT, TABLE_BITS, lfo->phase) * lfo->depth;
+    }
+}
+
+// Fill mod[0..n) with the per-frame frequency multiplier produced by the LFO.
+// The LFO moves far slower than audio, so it is evaluated at control rate,
+// once every LFO_CONTROL_PERIOD samples, and mod ramps linearly from the last
+// value to the new one. Segments carry over between blocks, so the ramp is
+// the same whatever block sizes the device asks for, and square edges and
+// depth changes are spread over a segment instead of stepping.
+static void render_lfo(lfo_filter* lfo, float* mod, uint32_t n) {
+    const uint32_t inc = phase_inc(lfo->base_freq) * LFO_CONTROL_PERIOD;
+    float value = lfo->value;
+    uint32_t i = 0;
+
+    while (i < n) {
+        if (lfo->remaining == 0) {
+            lfo->phase += inc;
+            lfo->step = (lfo_eval(lfo) - value) * (1.0f / LFO_CONTROL_PERIOD);
+            lfo->remaining = LFO_CONTROL_PERIOD;
+        }
+        uint32_t m = n - i < lfo->remaining ? n - i : lfo->remaining;
+        lfo->remaining -= m;
+        for (; m > 0; m--) {
+            mod[i++] = value;
+            value += lfo->step;
+        }
+    }
+    lfo->value = value;
+}
+
+#define VK_ISA VK_ISA_SCALAR
+#define VK_SUFFIX scalar
+#include "voice_kernel.h"
+
+#if defined(VOICE_KERNEL_X86)
+#define VK_ISA VK_ISA_SSE41
+#define VK_SUFFIX sse41
+#define VK_TARGET "sse4.1"
+#include "voice_kernel.h"
+
+#define VK_ISA VK_ISA_AVX2
+#define VK_SUFFIX avx2
+#define VK_TARGET "avx2"
+#include "voice_kernel.h"
+
+#define VK_ISA VK_ISA_AVX512
+#define VK_SUFFIX avx512
+#define VK_TARGET "avx512f"
+#include "voice_kernel.h"
+#elif defined(__ARM_NEON)
+#define VK_ISA VK_ISA_NEON
+#define VK_SUFFIX neon
+#include "voice_kernel.h"
+#endif
+
+typedef void (*voice_kernel_fn)(WaveType wave, uint32_t* phases, const float* incs, const float* gains,
+                                float* levels, const float* coefs, const float* bases,
+                                int count, const float* mod, float* mix, uint32_t n);
+
+typedef struct {
+    const char* name;
+    voice_kernel_fn voices;
+    int lanes;  // Voices per vector group.
+} voice_kernels;
+
+// Widest first; render_voices steps down this list for small voice counts.
+static const voice_kernels VOICE_KERNELS[] = {
+#if defined(VOICE_KERNEL_X86)
+    { "avx512", voice_kernel_avx512, 16 },
+    { "avx2",   voice_kernel_avx2,   8 },
+    { "sse4.1", voice_kernel_sse41,  4 },
+#elif defined(__ARM_NEON)
+    { "neon",   voice_kernel_neon,   4 },
+#endif
+    { "scalar", voice_kernel_scalar, 1 },
+};
+#define NUM_VOICE_KERNELS (sizeof(VOICE_KERNELS) / sizeof(VOICE_KERNELS[0]))
+
+// Widest kernel the render path may use, as an index into VOICE_KERNELS.
+// Chosen once by select_voice_kernels() before the device starts, so the
+// callback only pays for an indirect call.
+static size_t active_kernel = NUM_VOICE_KERNELS - 1;
+
+static int cpu_supports_kernel(const char* name) {
+#if defined(VOICE_KERNEL_X86)
+    __builtin_cpu_init();
+    if (strcmp(name, "avx512") == 0) return __builtin_cpu_supports("avx512f");
+    if (strcmp(name, "avx2") == 0)   return __builtin_cpu_supports("avx2");
+    if (strcmp(name, "sse4.1") == 0) return __builtin_cpu_supports("sse4.1");
+#endif
+    (void)name;
+    return 1;
+}
+
+// Pick the widest kernel this CPU supports. If force is non-NULL (e.g. from the
+// SYNTH_KERNEL environment variable) that kernel is used instead, provided the
+// CPU can run it. Returns the name of the selected kernel.
+const char* select_voice_kernels(const char* force) {
+    for (size_t i = 0; i < NUM_VOICE_KERNELS; i++) {
+        if (force != NULL && strcmp(force, VOICE_KERNELS[i].name) != 0) continue;
+        if (!cpu_supports_kernel(VOICE_KERNELS[i].name)) continue;
+        active_kernel = i;
+        return VOICE_KERNELS[i].name;
+    }
+    if (force != NULL) {
+        fprintf(stderr, "Voice kernel '%s' unavailable, using autodetect.\n", force);
+        return select_voice_kernels(NULL);
+    }
+    return VOICE_KERNELS[active_kernel].name;
+}
+
+// Kernel for count voices: the narrowest at or below the selected one whose
+// group still covers them all. Every group costs as much as a full one and
+// its lanes are summed each sample, so a 3-voice drone runs faster as one
+// SSE group than as one mostly silent AVX-512 group.
+static voice_kernel_fn voice_kernel_for(int count) {
+    size_t i = active_kernel;
+    while (i + 1 < NUM_VOICE_KERNELS && VOICE_KERNELS[i + 1].lanes >= count) i++;
+    return VOICE_KERNELS[i].voices;
+}
+
+// Accumulate all voices into mix[0..n).
+static void render_voices(oscillator* osc, const float* mod, float* mix, uint32_t n) {
+    VOICE_ALIGN float incs[MAX_VOICES];
+    VOICE_ALIGN float coefs[MAX_VOICES];
+    VOICE_ALIGN float bases[MAX_VOICES];
+    for (int k = 0; k < osc->active; k++) {
+        incs[k] = osc->freqs[k] * (PHASE_SCALE / SAMPLE_RATE);
+        coefs[k] = osc->env.coef[osc->stages[k]];
+        bases[k] = osc->env.base[osc->stages[k]];
+    }
+    for (uint32_t i = 0; i < n; i++) mix[i] = 0.0f;
+
+    const voice_kernel_fn voices = voice_kernel_for(osc->active);
+    voices(osc->wave_type, osc->phases, incs, osc->gains,
+           osc->levels, coefs, bases, osc->active, mod, mix, n);
+    voice_env_update(osc);
+}
+
+#define SMOOTH_TIME 0.02f  // Seconds for a parameter to cover 1 - 1/e of a change.
+
+// Start every smoothed parameter at its current value.
+static void smooth_reset(synth_params* params) {
+    params->targets.osc_freq = params->osc.base_freq;
+    params->targets.lfo_freq = params->lfo.base_freq;
+    params->targets.lfo_depth = params->lfo.depth;
+}
+
+// Ease value one block towards target with a one-pole step, landing exactly
+// once the gap is negligible. Returns 0 when there was nothing to do, which
+// is the common case.
+static int smooth_toward(float* value, float target) {
+    const float gap = target - *value;
+    if (gap == 0.0f) return 0;
+    if (fabsf(gap) <= 1e-4f * fabsf(target) + 1e-6f) *value = target;
+    else *value += gap * (1.0f - expf(-RENDER_BLOCK_SIZE / (SMOOTH_TIME * SAMPLE_RATE)));
+    return 1;
+}
+
+// Per-block parameter smoothing. Frequencies change the phase increment, not
+// the phase, so block-sized steps along the glide are inaudible; LFO depth is
+// further ramped per sample by render_lfo.
+static void smooth_params(synth_params* params) {
+    oscillator* osc = &params->osc;
+    if (smooth_toward(&osc->base_freq, params->targets.osc_freq)) {
+        for (int k = 0; k < osc->active; k++) {
+            if (osc->notes[k] == NOTE_DRONE) osc->freqs[k] = osc->base_freq * osc->detunes[k];
+        }
+    }
+    smooth_toward(&params->lfo.base_freq, params->targets.lfo_freq);
+    smooth_toward(&params->lfo.depth, params->targets.lfo_depth);
+}
+
+// Hard clip for the float output. Chords past full scale distort instead of
+// reaching the device out of range; compiles to a min/max pair.
+static inline float output_clip(float x) {
+    x = x > -1.0f ? x : -1.0f;
+    return x < 1.0f ? x : 1.0f;
+}
+
+void synth_render(synth_params* params, float* out, uint32_t frameCount, int channels) {
+    float mod[RENDER_BLOCK_SIZE];
+    float mix[RENDER_BLOCK_SIZE];
+
+    apply_cmds(params);
+
+    while (frameCount > 0) {
+        uint32_t n = frameCount < RENDER_BLOCK_SIZE ? frameCount : RENDER_BLOCK_SIZE;
+
+        smooth_params(params);
+        render_lfo(&params->lfo, mod, n);
+        render_voices(&params->osc, mod, mix, n);
+
+        if (channels == 2) {
+            for (uint32_t i = 0; i < n; i++) {
+                // Write stereo sample.
+                const float sample = output_clip(mix[i]);
+                *out++ = sample;
+                *out++ = sample;
+            }
+        } else {
+            for (uint32_t i = 0; i < n; i++) {
+                const float sample = output_clip(mix[i]);
+                for (int c = 0; c < channels; c++) *out++ = sample;
+            }
+        }
+        frameCount -= n;
+    }
+}
+
+// Fixed-point render for the MCP4921. Control state (commands, smoothing, the
+// LFO ramp, envelope stage changes) is shared with synth_render; per sample
+// the voices run on integer phases, Q15 tables and Q30 envelope levels, and
+// are mixed into a Q24 accumulator with saturating adds, which on the
+// Cortex-M7 map to its DSP instructions.
+#define Q15_ONE 32768
+#define Q24_ONE (1 << 24)
+#define Q30_ONE (1 << 30)
+
+#if defined(__ARM_FEATURE_DSP)
+    #include <arm_acle.h>
+#endif
+
+static inline int32_t q_add_sat(int32_t a, int32_t b) {
+#if defined(__ARM_FEATURE_DSP)
+    return __qadd(a, b);
+#else
+    const int64_t s = (int64_t)a + b;
+    return s > INT32_MAX ? INT32_MAX : s < INT32_MIN ? INT32_MIN : (int32_t)s;
+#endif
+}
+
+// Q15 table read with linear interpolation on the top 16 fraction bits.
+static inline int32_t table_lookup_q15(const int16_t* table, int bits, uint32_t phase) {
+    const uint32_t i = phase >> (32 - bits);
+    const int32_t frac = (int32_t)((phase << bits) >> 16);
+    return table[i] + (((table[i + 1] - table[i]) * frac) >> 16);
+}
+
+// 1 - d/dt in Q15 for a distance d (phase units) from an edge closer than dt,
+// else 0: the PolyBLEP/BLAMP ramp. recip is 2^48 / dt, so d * recip stays
+// below 2^48 whenever d < dt.
+static inline int32_t blep_ramp_q15(uint32_t d, uint32_t dt, uint64_t recip) {
+    if (d >= dt) return 0;
+    return Q15_ONE - (int32_t)(((uint64_t)d * recip) >> 33);
+}
+
+// The scalar shapes above in Q15; dt is the block's phase increment. The
+// PolyBLEP edges see the phase at phase_unit's 24 bits, as the float shapes
+// do, which matters once the LFO pulls dt down to a few hundred phase units.
+// The distance to the next wrap is taken as ~edge, one unit short, so a phase
+// at the wrap is a whole cycle from the next one rather than none.
+static inline int32_t eval_q15(WaveType wave, const int16_t* table, uint32_t phase,
+                               uint32_t dt, uint64_t recip) {
+    const uint32_t edge = phase & ~0xFFu;
+    switch (wave) {
+        case WAVE_SAW: {
+            const int32_t lo = blep_ramp_q15(edge, dt, recip), hi = blep_ramp_q15(~edge, dt, recip);
+            return ((int32_t)(phase ^ 0x80000000u) >> 16) + ((lo * lo - hi * hi) >> 15);
+        }
+        case WAVE_SQU: {
+            const uint32_t half = edge + 0x80000000u;
+            const int32_t lo = blep_ramp_q15(edge, dt, recip), hi = blep_ramp_q15(~edge, dt, recip);
+            const int32_t hlo = blep_ramp_q15(half, dt, recip), hhi = blep_ramp_q15(~half, dt, recip);
+            const int32_t edges = ((lo * lo - hi * hi) >> 15) - ((hlo * hlo - hhi * hhi) >> 15);
+            return (phase & 0x80000000u ? Q15_ONE : -Q15_ONE) + edges;
+        }
+        case WAVE_TRI: {
+            // Distances to the corner at the wrap and the one half a cycle on.
+            const uint32_t d0 = phase & 0x80000000u ? -phase : phase;
+            const uint32_t dh = phase & 0x80000000u ? phase - 0x80000000u : 0x80000000u - phase;
+            const int64_t r0 = blep_ramp_q15(d0, dt, recip), rh = blep_ramp_q15(dh, dt, recip);
+            const int64_t blamp = (r0 * r0 * r0 - rh * rh * rh) >> 21;  // Q24
+            return -Q15_ONE + (int32_t)(d0 >> 15) + (int32_t)((blamp * dt * 4 / 3) >> 41);
+        }
+        case WAVE_TABLE:
+            return table_lookup_q15(table, WT_BITS, phase) * (1 << SAW_WAVETABLE_Q15_SHIFT);
+        case WAVE_SIN:
+        default:
+            return table_lookup_q15(table, TABLE_BITS, phase);
+    }
+}
+
+// render_voices with every voice on the fixed-point path, accumulating into
+// mix[0..n) in Q24. Levels go back to osc as floats for the stage changes.
+// The phase step is the float kernels' own expression, inc * mod truncated,
+// so both paths keep bit-identical phases whatever the LFO depth; on the
+// Cortex-M7 that is one FPU multiply and convert per voice-sample.
+static void render_voices_q(oscillator* osc, const float* mod, int32_t* mix, uint32_t n) {
+    float max_mod = 0.0f;
+    for (uint32_t i = 0; i < n; i++) max_mod = fabsf(mod[i]) > max_mod ? fabsf(mod[i]) : max_mod;  // As voice_loop.
+    for (uint32_t i = 0; i < n; i++) mix[i] = 0;
+
+    const adsr* env = &osc->env;
+    for (int k = 0; k < osc->active; k++) {
+        const float incf = osc->freqs[k] * (PHASE_SCALE / SAMPLE_RATE);
+        const int16_t* table = osc->wave_type == WAVE_TABLE
+            ? SAW_WAVETABLE_Q15[wavetable_level(incf * max_mod * (1.0f / PHASE_SCALE))] : SINELUT_Q15;
+        const uint32_t dt = (uint32_t)(blep_dt(incf, mod[0]) * PHASE_SCALE);  // Phase units.
+        const uint64_t recip = ((uint64_t)1 << 48) / dt;
+        const int32_t gain = (int32_t)(osc->gains[k] * Q15_ONE);
+        const int32_t coef = (int32_t)(env->coef[osc->stages[k]] * Q30_ONE);
+        const int32_t base = (int32_t)(env->base[osc->stages[k]] * Q30_ONE);
+        int32_t level = (int32_t)(osc->levels[k] * Q30_ONE);
+        uint32_t phase = osc->phases[k];
+
+        for (uint32_t i = 0; i < n; i++) {
+            const int32_t amp = (int32_t)(((int64_t)gain * level) >> 15);  // Q30
+            const int32_t s = eval_q15(osc->wave_type, table, phase, dt, recip);
+            mix[i] = q_add_sat(mix[i], (int32_t)(((int64_t)s * amp) >> 21));
+            phase += (uint32_t)(int32_t)(incf * mod[i]);
+            level = (int32_t)(((int64_t)level * coef) >> 30) + base;
+            level = level < Q30_ONE ? level : Q30_ONE;
+        }
+        osc->phases[k] = phase;
+        osc->levels[k] = (float)level * (1.0f / Q30_ONE);
+    }
+    voice_env_update(osc);
+}
+
+static inline uint16_t mcp4921_code(int32_t mix_q24) {
+    const int32_t code = (int32_t)(((int64_t)mix_q24 + Q24_ONE + (1 << 12)) >> 13);
+    return (uint16_t)(code < 0 ? 0 : code > 4095 ? 4095 : code);
+}
+
+uint16_t mcp4921_word(float sample) {
+    const float code = (sample + 1.0f) * 2048.0f + 0.5f;
+    return MCP4921_CONFIG | (uint16_t)(code < 0.0f ? 0.0f : code > 4095.0f ? 4095.0f : code);
+}
+
+void synth_render_mcp4921(synth_params* params, uint16_t* out, uint32_t frameCount) {
+    float mod[RENDER_BLOCK_SIZE];
+    int32_t mix[RENDER_BLOCK_SIZE];
+
+    apply_cmds(params);
+
+    while (frameCount > 0) {
+        uint32_t n = frameCount < RENDER_BLOCK_SIZE ? frameCount : RENDER_BLOCK_SIZE;
+
+        smooth_params(params);
+        render_lfo(&params->lfo, mod, n);
+        render_voices_q(&params->osc, mod, mix, n);
+
+        for (uint32_t i = 0; i < n; i++) *out++ = MCP4921_CONFIG | mcp4921_code(mix[i]);
+        frameCount -= n;
+    }
+}
+
+void synth_init(synth_params* params, WaveType wave, int num_voices) {
+    memset(params, 0, sizeof(*params));
+    params->osc.base_freq = 240.0f;
+    params->osc.wave_type = wave;
+    params->osc.num_voices = num_voices;
+    adsr_set(&params->osc.env, 0.01f, 0.2f, 0.7f, 0.3f);
+    for (int k = 0; k < MAX_VOICES; k++) { 
+        params->osc.spread[k] = 0.99f + ((float)rand() / RAND_MAX) * 0.01f; // random variation between 99% and 100% of the note frequency
+    } 
+    voice_note_on(&params->osc, NOTE_DRONE, DRONE_VELOCITY);
+
+    params->lfo.depth = 0.2f;
+    params->lfo.base_freq = 10.0f;
+    params->lfo.value = 1.0f;
+    params->lfo.wave_type = WAVE_SAW;  // You can change this to WAVE_SIN or WAVE_SQU.
+    smooth_reset(params);
+}
+
+// One read per cache line; on the host that also faults every page in.
+void synth_touch_tables(void) {
+    const volatile unsigned char* sine = (const volatile unsigned char*)SINELUT;
+    const volatile unsigned char* saw = (const volatile unsigned char*)SAW_WAVETABLE;
+    for (size_t i = 0; i < sizeof(SINELUT); i += 64) (void)sine[i];
+    for (size_t i = 0; i < sizeof(SAW_WAVETABLE); i += 64) (void)saw[i];
+}
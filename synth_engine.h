@@ -0,0 +1,204 @@
+// synth_engine.h -- the synth engine shared by every front-end: the host
+// player (main.c), the benchmarks (bench.c) and the Teensy builds (main2.c,
+// main3.c). It holds the voice pool, envelopes, LFO and command queue behind
+// a block-render API; front-ends own the audio device or DAC, timing and UI.
+// The engine never allocates, blocks or touches hardware.
+#ifndef SYNTH_ENGINE_H
+#define SYNTH_ENGINE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Engine and front-end must agree on the rate; slower DAC targets pass
+// -DSAMPLE_RATE=... to both.
+#ifndef SAMPLE_RATE
+#define SAMPLE_RATE 48000.0f
+#endif
+#define MAX_VOICES 256  // Multiple of VOICE_MAX_LANES, the widest kernel, so the SoA arrays pad cleanly.
+
+#define VOICE_ALIGN __attribute__((aligned(64)))
+
+// Define waveform types.
+typedef enum {
+    WAVE_SIN,
+    WAVE_SAW,
+    WAVE_SQU,
+    WAVE_TRI,       // Band-limited triangle (oscillator only).
+    WAVE_TABLE      // Mip-mapped band-limited wavetable (oscillator only).
+} WaveType;
+
+#define NUM_OSC_WAVES 5
+#define NUM_LFO_WAVES 3
+
+const char* wave_name(WaveType wave);
+
+// ADSR envelope. Each segment is a one-pole curve aimed past its end point,
+// level = level * coef + base, so a sample costs one multiply-add whatever the
+// stage. coef/base are recomputed only when a time or the sustain level changes.
+typedef enum {
+    ENV_ATTACK,
+    ENV_DECAY,
+    ENV_SUSTAIN,
+    ENV_RELEASE,
+    ENV_STAGES
+} EnvStage;
+
+#define ENV_ATTACK_RATIO 0.3f     // Attack overshoot target: a near-linear rise.
+#define ENV_DECAY_RATIO 0.0001f   // Decay/release undershoot: exponential fall.
+#define ENV_IDLE_LEVEL 0.0001f    // -80 dB: a released voice below this is freed.
+#define ENV_MIN_TIME 0.001f
+#define ENV_MAX_TIME 10.0f
+
+typedef struct {
+    float attack;   // Seconds.
+    float decay;    // Seconds.
+    float sustain;  // Level, 0..1.
+    float release;  // Seconds.
+    float coef[ENV_STAGES];
+    float base[ENV_STAGES];
+} adsr;
+
+#define NOTE_DRONE -1  // Note number of the drone held at base_freq.
+// A note's unison voices share its velocity, so it peaks near that level.
+// The drone and two keyboard notes together reach full scale; synth_render
+// clips anything beyond to [-1, 1].
+#define DRONE_VELOCITY 0.5f
+#define NOTE_VELOCITY 0.25f
+
+// Structure to hold oscillator state: a pool of MAX_VOICES voices kept as
+// aligned structure-of-arrays so the voice kernel can load VK_LANES at a
+// time. Sounding voices are packed into [0, active), so the kernel only ever
+// walks live voices and cost scales with the notes being played. Each note
+// takes num_voices detuned unison voices from the pool and leaves it once its
+// release has decayed to ENV_IDLE_LEVEL.
+typedef struct {
+    float base_freq;      // Drone pitch.
+    WaveType wave_type;
+    int num_voices;       // Unison voices per note.
+    int active;
+    uint32_t note_count; // Notes started so far; stamps voice ages.
+    adsr env;
+    float spread[MAX_VOICES];  // Detune ratio of each unison position.
+    VOICE_ALIGN float freqs[MAX_VOICES];
+    VOICE_ALIGN uint32_t phases[MAX_VOICES];
+    VOICE_ALIGN float gains[MAX_VOICES];
+    VOICE_ALIGN float levels[MAX_VOICES];  // Envelope output.
+    EnvStage stages[MAX_VOICES];
+    float detunes[MAX_VOICES];
+    int notes[MAX_VOICES];
+    uint32_t ages[MAX_VOICES];
+} oscillator;
+
+// Frames per internal render block. synth_render splits every call into
+// blocks of this size, so it, not the caller's frame count, sets the work
+// per kernel pass.
+#ifndef RENDER_BLOCK_SIZE
+#define RENDER_BLOCK_SIZE 64
+#endif
+
+// Samples between LFO evaluations; the output is ramped linearly in between.
+#ifndef LFO_CONTROL_PERIOD
+#define LFO_CONTROL_PERIOD 32
+#endif
+
+typedef struct { 
+    float depth;        
+    float base_freq;     
+    uint32_t phase;         
+    WaveType wave_type;   
+    float value;          // Current output, the frequency multiplier.
+    float step;           // Per-sample change towards the next control point.
+    uint32_t remaining;  // Samples left before the next evaluation.
+} lfo_filter;
+
+// Parameter changes sent from the control thread to the audio thread. Values
+// are absolute so a command never depends on state the sender cannot see.
+typedef enum {
+    CMD_OSC_WAVE,
+    CMD_OSC_FREQ,       // New base frequency; drone voices glide to it.
+    CMD_LFO_WAVE,
+    CMD_LFO_FREQ,
+    CMD_LFO_DEPTH,
+    CMD_NUM_VOICES,     // Unison voices per note; restrikes the drone.
+    CMD_NOTE_ON,        // Value is the note number (NOTE_DRONE for the drone).
+    CMD_NOTE_OFF,
+    CMD_ENV_ATTACK,     // Seconds.
+    CMD_ENV_DECAY,      // Seconds.
+    CMD_ENV_SUSTAIN,    // Level, 0..1.
+    CMD_ENV_RELEASE     // Seconds.
+} synth_cmd_type;
+
+typedef struct {
+    synth_cmd_type type;
+    float value;
+} synth_cmd;
+
+#define CMD_QUEUE_SIZE 64  // Power of two.
+
+// Wait-free single-producer/single-consumer ring. head is only written by the
+// control thread and tail only by the audio thread, so neither side ever waits.
+typedef struct {
+    synth_cmd cmds[CMD_QUEUE_SIZE];
+    VOICE_ALIGN uint32_t head;
+    VOICE_ALIGN uint32_t tail;
+} cmd_queue;
+
+// Where the continuous parameters are heading. Commands set these and the
+// audio thread eases the live values in osc and lfo towards them, so a key
+// press never steps a frequency or depth.
+typedef struct {
+    float osc_freq;
+    float lfo_freq;
+    float lfo_depth;
+} param_targets;
+
+// Render-side state. Once rendering starts only the audio thread (or ISR)
+// touches osc and lfo; other threads talk to it through cmds.
+typedef struct { 
+    oscillator osc;
+    lfo_filter lfo;
+    param_targets targets;
+    cmd_queue cmds;
+} synth_params;
+
+// Set params up with the drone sounding: wave with num_voices unison voices,
+// and the default envelope and LFO.
+void synth_init(synth_params* params, WaveType wave, int num_voices);
+
+// Apply pending commands, then render frames samples into out, writing each
+// to channels consecutive slots: 1 for a mono DAC, 2 for interleaved stereo.
+// Samples are clipped to [-1, 1].
+void synth_render(synth_params* params, float* out, uint32_t frames, int channels);
+
+// MCP4921 command bits above the 12-bit code: write, unbuffered Vref, 1x
+// gain, output active.
+#define MCP4921_CONFIG 0x3000u
+
+// synth_render for a 12-bit MCP4921: renders frames mono samples in fixed
+// point (integer phases, Q15 tables, saturating mix) straight to packed
+// command words. Shares params with synth_render; within a few LSB of
+// mcp4921_word() applied to its output.
+void synth_render_mcp4921(synth_params* params, uint16_t* out, uint32_t frames);
+
+// Command word for a float sample in [-1, 1], clamped.
+uint16_t mcp4921_word(float sample);
+
+// Queue a command for the render side; call from a single producer. Returns 0
+// if the queue is full and the command was dropped.
+int cmd_queue_push(cmd_queue* q, synth_cmd cmd);
+
+// Pick the voice kernel: force names one ("scalar", "sse4.1", "avx2",
+// "avx512", "neon"), otherwise the widest the CPU supports. Returns its name.
+const char* select_voice_kernels(const char* force);
+
+// Read through the const tables so they are resident before real-time use.
+void synth_touch_tables(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SYNTH_ENGINE_H
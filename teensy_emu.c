@@ -0,0 +1,437 @@
+// teensy_emu.c -- runs main3.c on the host against an emulated PIT and LPSPI4.
+//
+// main3.c is compiled into this file with TEENSY_EMU defined, so its ISR,
+// double buffer and main loop run unchanged. The PIT fires at the rate
+// pit_init programs, counted in emulated CPU cycles. The LPSPI4 TX FIFO drains
+// one word per frame, timed from the TCR and CCR main3 programs; every word
+// written to it is recorded as what the MCP4921 would receive and checked
+// against the float engine. The fixed-point path is then checked for every
+// wave at settings main3 does not use. Register accesses and ISR entry are
+// charged in cycles; the main loop costs its host CPU time scaled by
+// --fg-scale. Build and run with `./nob emu`.
+#include <math.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define main teensy_main
+#include "main3.c"
+#undef main
+
+#define EMU_F_CPU 600000000.0     // Teensy 4.1 core clock.
+#define EMU_REG_CYCLES 20         // One peripheral register access.
+#define EMU_ISR_ENTRY_CYCLES 24   // Exception entry and return.
+#define EMU_STUCK_SECONDS 0.1     // One ISR running this long is a hang.
+#define EMU_TOLERANCE_LSB 4       // Fixed-point vs float engine, in DAC codes.
+#define EMU_CHECK_SECONDS 5.0     // Audio per engine check case.
+#define LPSPI_FIFO_DEPTH 16
+
+emu_regs emu_reg;
+
+typedef struct {
+    uint32_t* data;
+    size_t count, cap;
+} word_log;
+
+typedef struct {
+    // Time, in CPU cycles.
+    uint64_t now;
+    double next_tick;
+    double tick_cycles;
+    uint64_t word_cycles;     // Length of the last SPI frame.
+    double lpspi_hz;          // LPSPI clock root.
+    double fg_scale;
+    double seconds;
+    uint64_t target_ticks;
+    int tolerance;            // LSB allowed against the float engine.
+    double check_seconds;
+
+    // LPSPI4 TX FIFO: the time each queued word moves into the shifter.
+    uint64_t fifo_start[LPSPI_FIFO_DEPTH];
+    uint32_t fifo_head, fifo_count;
+    uint64_t shift_until;     // When the shifter finishes its last word.
+    uint32_t overflow_slot;   // TDR writes with a full FIFO land here.
+
+    word_log sent;            // Words the DAC received.
+
+    // Statistics.
+    uint64_t ticks;
+    uint64_t overflows;       // TDR writes dropped by a full FIFO.
+    uint64_t busy_polls;      // Status reads that found the FIFO above its watermark.
+    uint64_t fifo_dry;        // Times the shifter went idle between words.
+    uint64_t dry_cycles;
+    uint64_t isr_cycles, isr_cycles_max;
+    uint64_t late_ticks;      // Ticks held off past their due time.
+    uint64_t late_cycles_max;
+    uint64_t fg_cycles;
+    double isr_host_ns, isr_host_ns_max;
+    uint64_t isr_start;
+    int in_isr;
+
+    const char* out_path;
+    struct timespec fg_t0;
+    jmp_buf done;
+} emu_state;
+
+static emu_state emu;
+
+// Host time is this thread's CPU time, so a preempted emulator is not charged
+// for the time it spent descheduled.
+#define EMU_CLOCK CLOCK_THREAD_CPUTIME_ID
+
+static double seconds_since(const struct timespec* t0) {
+    struct timespec t;
+    clock_gettime(EMU_CLOCK, &t);
+    return (double)(t.tv_sec - t0->tv_sec) + (double)(t.tv_nsec - t0->tv_nsec) * 1e-9;
+}
+
+static uint32_t* word_log_push(word_log* log) {
+    if (log->count == log->cap) {
+        log->cap = log->cap ? log->cap * 2 : 65536;
+        log->data = realloc(log->data, log->cap * sizeof(*log->data));
+        if (log->data == NULL) {
+            fprintf(stderr, "teensy_emu: out of memory\n");
+            exit(1);
+        }
+    }
+    return &log->data[log->count++];
+}
+
+// Words whose transfer has started leave the FIFO for the shifter.
+static void lpspi_retire(void) {
+    while (emu.fifo_count > 0 && emu.fifo_start[emu.fifo_head] <= emu.now) {
+        emu.fifo_head = (emu.fifo_head + 1) % LPSPI_FIFO_DEPTH;
+        emu.fifo_count--;
+    }
+}
+
+static void charge_register(void) {
+    emu.now += EMU_REG_CYCLES;
+    lpspi_retire();
+    if (emu.in_isr && (double)(emu.now - emu.isr_start) > EMU_STUCK_SECONDS * EMU_F_CPU) {
+        fprintf(stderr, "teensy_emu: pit_isr still running after %.0f ms (TX FIFO holds %u words)\n",
+                EMU_STUCK_SECONDS * 1000.0, emu.fifo_count);
+        exit(1);
+    }
+}
+
+// Words shifted out so far; unless TCR masks it, the RX FIFO gets one per
+// word and is never read.
+static uint32_t lpspi_rx_count(void) {
+    if (emu_reg.lpspi4_tcr & LPSPI_TCR_RXMSK) return 0;
+    const uint64_t in_flight = emu.fifo_count + (emu.shift_until > emu.now);
+    const uint64_t done = emu.sent.count - in_flight;
+    return done < LPSPI_FIFO_DEPTH ? (uint32_t)done : LPSPI_FIFO_DEPTH;
+}
+
+uint32_t emu_lpspi4_sr(void) {
+    charge_register();
+    uint32_t sr = 0;
+    if (emu.fifo_count <= (emu_reg.lpspi4_fcr & 0x0F)) sr |= LPSPI_SR_TDF;
+    else emu.busy_polls++;
+    if (lpspi_rx_count() > 0) sr |= LPSPI_SR_RDF;
+    if (emu.shift_until > emu.now) sr |= LPSPI_SR_MBF;
+    return sr;
+}
+
+uint32_t emu_lpspi4_fsr(void) {
+    charge_register();
+    return emu.fifo_count | (lpspi_rx_count() << 16);  // TXCOUNT, RXCOUNT
+}
+
+// CPU cycles for one frame as TCR and CCR program it: PCS-to-SCK delay, the
+// bits, SCK-to-PCS delay and the gap before the next frame, in functional
+// clocks of the prescaled LPSPI root.
+static uint64_t lpspi_frame_cycles(void) {
+    const uint32_t tcr = emu_reg.lpspi4_tcr, ccr = emu_reg.lpspi4_ccr;
+    const double fclk = emu.lpspi_hz / (double)(1u << ((tcr >> 27) & 0x7));
+    const uint32_t bits = (tcr & 0xFFF) + 1;
+    const uint32_t sckdiv = ccr & 0xFF, dbt = (ccr >> 8) & 0xFF;
+    const uint32_t pcssck = (ccr >> 16) & 0xFF, sckpcs = (ccr >> 24) & 0xFF;
+    const uint32_t clocks = (pcssck + 1) + bits * (sckdiv + 2) + (sckpcs + 1) + (dbt + 2);
+    return (uint64_t)((double)clocks * EMU_F_CPU / fclk + 0.5);
+}
+
+volatile uint32_t* emu_lpspi4_tdr(void) {
+    charge_register();
+    if (emu.fifo_count == LPSPI_FIFO_DEPTH) {
+        emu.overflows++;
+        return &emu.overflow_slot;
+    }
+    if (emu.sent.count > 0 && emu.now > emu.shift_until) {
+        // Nothing was queued when the last frame ended: the DAC missed samples.
+        emu.fifo_dry++;
+        emu.dry_cycles += emu.now - emu.shift_until;
+    }
+    emu.word_cycles = lpspi_frame_cycles();
+    const uint64_t start = emu.shift_until > emu.now ? emu.shift_until : emu.now;
+    emu.shift_until = start + emu.word_cycles;
+    emu.fifo_start[(emu.fifo_head + emu.fifo_count) % LPSPI_FIFO_DEPTH] = start;
+    emu.fifo_count++;
+    return word_log_push(&emu.sent);
+}
+
+static void run_tick(void) {
+    const double late = (double)emu.now - emu.next_tick;
+    if (late >= 1.0) {
+        emu.late_ticks++;
+        if ((uint64_t)late > emu.late_cycles_max) emu.late_cycles_max = (uint64_t)late;
+    }
+    emu.next_tick += emu.tick_cycles;
+
+    PIT_TFLG0 = 1;
+
+    struct timespec t0;
+    clock_gettime(EMU_CLOCK, &t0);
+    emu.isr_start = emu.now;
+    emu.in_isr = 1;
+    emu.now += EMU_ISR_ENTRY_CYCLES;
+    pit_isr();
+    emu.in_isr = 0;
+    const double host_ns = seconds_since(&t0) * 1e9;
+    const uint64_t cycles = emu.now - emu.isr_start;
+
+    emu.ticks++;
+    emu.isr_cycles += cycles;
+    if (cycles > emu.isr_cycles_max) emu.isr_cycles_max = cycles;
+    emu.isr_host_ns += host_ns;
+    if (host_ns > emu.isr_host_ns_max) emu.isr_host_ns_max = host_ns;
+}
+
+// Charges the main loop's run since fg_t0. A PIT tick that falls due part way
+// through preempts it there: the ISR runs at its due time and sees the ring
+// as the main loop left it, without the half still being rendered.
+static void run_main_loop(void) {
+    uint64_t fg = (uint64_t)(seconds_since(&emu.fg_t0) * EMU_F_CPU * emu.fg_scale);
+    emu.fg_cycles += fg;
+    while (emu.tick_cycles > 0.0 && (double)(emu.now + fg) >= emu.next_tick) {
+        const uint64_t until = (double)emu.now < emu.next_tick ? (uint64_t)ceil(emu.next_tick) - emu.now : 0;
+        emu.now += until;
+        fg -= until;
+        run_tick();
+        if (emu.ticks >= emu.target_ticks) longjmp(emu.done, 1);
+    }
+    emu.now += fg;
+}
+
+// Hooked into audio_ring_fill after each half is rendered, before it is
+// published.
+void emu_half_rendered(void) {
+    run_main_loop();
+    clock_gettime(EMU_CLOCK, &emu.fg_t0);
+}
+
+// main3's idle point. Charges the rest of the main loop's run, then sleeps to
+// the next PIT tick.
+void emu_wait_for_interrupt(void) {
+    run_main_loop();
+
+    if ((PIT_TCTRL0 & 0x3) != 0x3 || !(emu_reg.nvic_iser[IRQ_PIT >> 5] & (1u << (IRQ_PIT & 31)))) {
+        fprintf(stderr, "teensy_emu: main loop waits for an interrupt with the PIT interrupt disabled\n");
+        exit(1);
+    }
+    if (emu.tick_cycles == 0.0) {
+        emu.tick_cycles = ((double)PIT_LDVAL0 + 1.0) * (EMU_F_CPU / PIT_CLOCK_HZ);
+        emu.next_tick = (double)emu.now + emu.tick_cycles;
+        emu.target_ticks = (uint64_t)(emu.seconds * EMU_F_CPU / emu.tick_cycles);
+    }
+
+    if ((double)emu.now < emu.next_tick) emu.now = (uint64_t)ceil(emu.next_tick);
+    while ((double)emu.now >= emu.next_tick) {
+        run_tick();
+        if (emu.ticks >= emu.target_ticks) longjmp(emu.done, 1);
+    }
+    clock_gettime(EMU_CLOCK, &emu.fg_t0);
+}
+
+static int write_words(const char* path, const word_log* log) {
+    FILE* f = fopen(path, "wb");
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+    for (size_t i = 0; i < log->count; i++) {
+        const uint16_t w = (uint16_t)log->data[i];
+        fwrite(&w, sizeof(w), 1, f);
+    }
+    fclose(f);
+    return 0;
+}
+
+// Words further than tolerance LSB from the float engine (scalar kernel)
+// rendered in the same AUDIO_RING_HALF blocks from the same srand(1) init, or with
+// the wrong MCP4921 command bits. An unbroken stream stays within a few LSB.
+static size_t reference_mismatches(size_t* first, int* max_diff) {
+    static synth_params ref;
+    float block[AUDIO_RING_HALF];
+    size_t mismatches = 0;
+    *first = emu.sent.count;
+    *max_diff = 0;
+    srand(1);
+    synth_init(&ref, SYNTH_WAVE, SYNTH_VOICES);
+    for (size_t i = 0; i < emu.sent.count; i += AUDIO_RING_HALF) {
+        synth_render(&ref, block, AUDIO_RING_HALF, 1);
+        for (size_t j = 0; j < AUDIO_RING_HALF && i + j < emu.sent.count; j++) {
+            const uint16_t got = (uint16_t)emu.sent.data[i + j], want = mcp4921_word(block[j]);
+            const int diff = abs((int)(got & 0x0FFF) - (int)(want & 0x0FFF));
+            if (diff > *max_diff) *max_diff = diff;
+            if ((got & 0xF000) == (want & 0xF000) && diff <= emu.tolerance) continue;
+            if (mismatches++ == 0) *first = i + j;
+        }
+    }
+    return mismatches;
+}
+
+// Engine settings checked beyond main3's own stream, for every oscillator
+// wave: main3's voices and depth, a depth past 1 so the LFO multiplier swings
+// through zero up to nearly 3, and many unison voices at a low pitch.
+typedef struct {
+    int voices;
+    float freq;
+    float depth;
+} engine_case;
+
+static const engine_case ENGINE_CASES[] = {
+    { SYNTH_VOICES, 240.0f, 0.2f },
+    { SYNTH_VOICES, 240.0f, 1.9f },
+    { 16, 50.0f, 0.5f },
+};
+
+// Largest distance, in DAC codes, between synth_render_mcp4921 and
+// mcp4921_word() over synth_render (scalar kernel) for one wave and case.
+static int engine_check_case(WaveType wave, const engine_case* c) {
+    static synth_params fixed, ref;
+    static float block[AUDIO_RING_HALF];
+    static uint16_t words[AUDIO_RING_HALF];
+    const synth_cmd cmds[] = { { CMD_OSC_FREQ, c->freq }, { CMD_LFO_DEPTH, c->depth } };
+    int max_diff = 0;
+
+    srand(1);
+    synth_init(&ref, wave, c->voices);
+    fixed = ref;
+    for (size_t i = 0; i < sizeof(cmds) / sizeof(cmds[0]); i++) {
+        cmd_queue_push(&ref.cmds, cmds[i]);
+        cmd_queue_push(&fixed.cmds, cmds[i]);
+    }
+    const uint64_t blocks = (uint64_t)(emu.check_seconds * SAMPLE_RATE) / AUDIO_RING_HALF;
+    for (uint64_t b = 0; b < blocks; b++) {
+        synth_render(&ref, block, AUDIO_RING_HALF, 1);
+        synth_render_mcp4921(&fixed, words, AUDIO_RING_HALF);
+        for (int j = 0; j < AUDIO_RING_HALF; j++) {
+            const int diff = abs((int)(words[j] & 0x0FFF) - (int)(mcp4921_word(block[j]) & 0x0FFF));
+            if (diff > max_diff) max_diff = diff;
+        }
+    }
+    return max_diff;
+}
+
+// Run every wave through ENGINE_CASES and print the worst distance of each.
+// Returns the number of wave/case pairs over the tolerance.
+static int engine_check(void) {
+    static const char* names[NUM_OSC_WAVES] = { "sin", "saw", "squ", "tri", "tbl" };
+    int failures = 0;
+    printf("Engine:     fixed point vs float engine, %.1f s per case, max LSB\n", emu.check_seconds);
+    printf("            %6s %7s %6s", "voices", "freq", "depth");
+    for (int w = 0; w < NUM_OSC_WAVES; w++) printf(" %3s ", names[w]);
+    printf("\n");
+    for (size_t i = 0; i < sizeof(ENGINE_CASES) / sizeof(ENGINE_CASES[0]); i++) {
+        const engine_case* c = &ENGINE_CASES[i];
+        printf("            %6d %7.1f %6.2f", c->voices, c->freq, c->depth);
+        for (int w = 0; w < NUM_OSC_WAVES; w++) {
+            const int diff = engine_check_case((WaveType)w, c);
+            if (diff > emu.tolerance) failures++;
+            printf(" %3d%s", diff, diff > emu.tolerance ? "!" : " ");
+        }
+        printf("\n");
+    }
+    return failures;
+}
+
+static int report(void) {
+    const double seconds = (double)emu.now / EMU_F_CPU;
+    const double ticks = emu.ticks ? (double)emu.ticks : 1.0;
+    size_t first;
+    int max_diff;
+    const size_t mismatches = reference_mismatches(&first, &max_diff);
+
+    const double words = emu.sent.count ? (double)emu.sent.count : 1.0;
+    printf("Emulated %.3f s: %llu PIT ticks at %.1f Hz, SPI frame %llu cycles (%.1f kHz)\n",
+           seconds, (unsigned long long)emu.ticks, EMU_F_CPU / emu.tick_cycles,
+           (unsigned long long)emu.word_cycles, EMU_F_CPU / (double)(emu.word_cycles ? emu.word_cycles : 1) * 1e-3);
+    printf("ISR:        %.1f cycles avg, %llu max, %.1f per DAC word, %.2f%% of the CPU; host %.0f ns avg, %.0f ns max\n",
+           (double)emu.isr_cycles / ticks, (unsigned long long)emu.isr_cycles_max, (double)emu.isr_cycles / words,
+           100.0 * (double)emu.isr_cycles / (double)emu.now, emu.isr_host_ns / ticks, emu.isr_host_ns_max);
+    printf("SPI:        %llu busy status polls (%llu stall cycles), %llu FIFO overflows, ran dry %llu times (%.2f us)\n",
+           (unsigned long long)emu.busy_polls, (unsigned long long)(emu.busy_polls * EMU_REG_CYCLES),
+           (unsigned long long)emu.overflows, (unsigned long long)emu.fifo_dry,
+           (double)emu.dry_cycles / EMU_F_CPU * 1e6);
+    printf("Main loop:  %.2f%% of the CPU (host time x %.2f)\n",
+           100.0 * (double)emu.fg_cycles / (double)emu.now, emu.fg_scale);
+    printf("Underruns:  %lu top-ups found their half not rendered; %llu ticks late (max %.2f us)\n",
+           (unsigned long)ring.underruns, (unsigned long long)emu.late_ticks,
+           (double)emu.late_cycles_max / EMU_F_CPU * 1e6);
+    printf("DAC words:  %zu received for %llu ticks, max %d LSB from the float engine, %zu over %d LSB",
+           emu.sent.count, (unsigned long long)emu.ticks, max_diff, mismatches, emu.tolerance);
+    if (mismatches > 0) printf(" (first at word %zu)", first);
+    printf("\n");
+    const int failures = emu.check_seconds > 0.0 ? engine_check() : 0;
+    return mismatches == 0 && failures == 0 ? 0 : 1;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [--seconds N] [--lpspi-mhz N] [--fg-scale X] [--tolerance LSB]\n"
+                    "          [--check-seconds N] [--out FILE]\n", prog);
+    fprintf(stderr, "  --seconds N   emulated run time (default 1)\n");
+    fprintf(stderr, "  --lpspi-mhz N LPSPI clock root; main3 divides it down (default %d)\n", LPSPI_CLOCK_HZ / 1000000);
+    fprintf(stderr, "  --fg-scale X  main loop cycles = host CPU time x X (default 1; 0 makes it free)\n");
+    fprintf(stderr, "  --tolerance LSB  allowed distance from the float engine (default %d); exit 1 if exceeded\n",
+            EMU_TOLERANCE_LSB);
+    fprintf(stderr, "  --check-seconds N  audio per engine check case, every wave (default %.0f; 0 skips)\n",
+            EMU_CHECK_SECONDS);
+    fprintf(stderr, "  --out FILE    write the DAC words as raw 16-bit samples\n");
+}
+
+int main(int argc, char** argv) {
+    emu.lpspi_hz = LPSPI_CLOCK_HZ;
+    emu.seconds = 1.0;
+    emu.fg_scale = 1.0;
+    emu.tolerance = EMU_TOLERANCE_LSB;
+    emu.check_seconds = EMU_CHECK_SECONDS;
+    for (int i = 1; i < argc; i++) {
+        const int has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--seconds") == 0 && has_value) {
+            emu.seconds = strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--lpspi-mhz") == 0 && has_value) {
+            emu.lpspi_hz = strtod(argv[++i], NULL) * 1e6;
+        } else if (strcmp(argv[i], "--fg-scale") == 0 && has_value) {
+            emu.fg_scale = strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--tolerance") == 0 && has_value) {
+            emu.tolerance = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--check-seconds") == 0 && has_value) {
+            emu.check_seconds = strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--out") == 0 && has_value) {
+            emu.out_path = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (emu.lpspi_hz <= 0.0 || emu.seconds <= 0.0 || emu.fg_scale < 0.0 || emu.check_seconds < 0.0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    srand(1);  // Same detune every run.
+    clock_gettime(EMU_CLOCK, &emu.fg_t0);
+    if (setjmp(emu.done) == 0) {
+        teensy_main();
+        fprintf(stderr, "teensy_emu: main3 returned from main\n");
+        return 1;
+    }
+
+    const int status = report();
+    if (emu.out_path != NULL && write_words(emu.out_path, &emu.sent) != 0) return 1;
+    return status;
+}
@@ -0,0 +1,90 @@
+// teensy_emu.h -- host stand-ins for the Teensy 4.1 registers main3.c uses.
+//
+// With -DTEENSY_EMU main3.c includes this instead of imxrt.h. Field encodings
+// and IRQ numbers still come from imxrt.h; the registers themselves are
+// redefined here. Configuration registers become plain fields of emu_reg. The
+// LPSPI4 status, FIFO status and transmit data registers call into
+// teensy_emu.c, which models the TX FIFO draining at the frame rate TCR and
+// CCR program and charges each access in emulated CPU cycles.
+#ifndef TEENSY_EMU_H
+#define TEENSY_EMU_H
+
+#include <stdint.h>
+
+// imxrt.h casts pointers to 32-bit addresses in its cache helpers.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpointer-to-int-cast"
+#include "imxrt.h"
+#pragma GCC diagnostic pop
+
+typedef struct {
+    uint32_t ccm_ccgr1;
+    uint32_t iomuxc_gpio_b0[4];
+    uint32_t pit_mcr;
+    uint32_t pit_ldval0;
+    uint32_t pit_cval0;
+    uint32_t pit_tctrl0;
+    uint32_t pit_tflg0;
+    uint32_t lpspi4_cr;
+    uint32_t lpspi4_cfgr1;
+    uint32_t lpspi4_ccr;
+    uint32_t lpspi4_fcr;
+    uint32_t lpspi4_tcr;
+    uint32_t nvic_iser[8];
+} emu_regs;
+
+extern emu_regs emu_reg;
+
+uint32_t emu_lpspi4_sr(void);
+uint32_t emu_lpspi4_fsr(void);
+volatile uint32_t* emu_lpspi4_tdr(void);  // Reserves the next TX FIFO slot.
+void emu_wait_for_interrupt(void);        // Advances time and runs due ticks.
+void emu_half_rendered(void);             // Lets due ticks preempt audio_ring_fill.
+
+#undef CCM_CCGR1
+#define CCM_CCGR1 (emu_reg.ccm_ccgr1)
+#undef IOMUXC_SW_MUX_CTL_PAD_GPIO_B0_00
+#undef IOMUXC_SW_MUX_CTL_PAD_GPIO_B0_01
+#undef IOMUXC_SW_MUX_CTL_PAD_GPIO_B0_02
+#undef IOMUXC_SW_MUX_CTL_PAD_GPIO_B0_03
+#define IOMUXC_SW_MUX_CTL_PAD_GPIO_B0_00 (emu_reg.iomuxc_gpio_b0[0])
+#define IOMUXC_SW_MUX_CTL_PAD_GPIO_B0_01 (emu_reg.iomuxc_gpio_b0[1])
+#define IOMUXC_SW_MUX_CTL_PAD_GPIO_B0_02 (emu_reg.iomuxc_gpio_b0[2])
+#define IOMUXC_SW_MUX_CTL_PAD_GPIO_B0_03 (emu_reg.iomuxc_gpio_b0[3])
+
+#undef PIT_MCR
+#undef PIT_LDVAL0
+#undef PIT_CVAL0
+#undef PIT_TCTRL0
+#undef PIT_TFLG0
+#define PIT_MCR    (emu_reg.pit_mcr)
+#define PIT_LDVAL0 (emu_reg.pit_ldval0)
+#define PIT_CVAL0  (emu_reg.pit_cval0)
+#define PIT_TCTRL0 (emu_reg.pit_tctrl0)
+#define PIT_TFLG0  (emu_reg.pit_tflg0)
+
+#undef LPSPI4_CR
+#undef LPSPI4_CFGR1
+#undef LPSPI4_CCR
+#undef LPSPI4_FCR
+#undef LPSPI4_TCR
+#undef LPSPI4_SR
+#undef LPSPI4_FSR
+#undef LPSPI4_TDR
+#define LPSPI4_CR    (emu_reg.lpspi4_cr)
+#define LPSPI4_CFGR1 (emu_reg.lpspi4_cfgr1)
+#define LPSPI4_CCR   (emu_reg.lpspi4_ccr)
+#define LPSPI4_FCR   (emu_reg.lpspi4_fcr)
+#define LPSPI4_TCR   (emu_reg.lpspi4_tcr)
+#define LPSPI4_SR    (emu_lpspi4_sr())
+#define LPSPI4_FSR   (emu_lpspi4_fsr())
+#define LPSPI4_TDR   (*emu_lpspi4_tdr())
+
+// NVIC_ENABLE_IRQ indexes from &NVIC_ISER0, so the array stands in for all 8.
+#undef NVIC_ISER0
+#define NVIC_ISER0 (emu_reg.nvic_iser[0])
+
+static inline void wait_for_interrupt(void) { emu_wait_for_interrupt(); }
+#define AUDIO_RING_HALF_RENDERED() emu_half_rendered()
+
+#endif // TEENSY_EMU_H
@@ -0,0 +1,372 @@
+// voice_kernel.h -- the unison voice kernel, instantiated once per instruction set.
+//
+// synth_engine.c includes this file several times. Before each include it defines:
+//   VK_ISA     one of VK_ISA_SCALAR, VK_ISA_SSE41, VK_ISA_AVX2, VK_ISA_AVX512, VK_ISA_NEON
+//   VK_SUFFIX  suffix for the exported function, e.g. avx2 -> voice_kernel_avx2
+//   VK_TARGET  (optional) target string the variant is compiled for, e.g. "avx2"
+// Everything declared here is static and suffixed, so the variants can coexist in
+// one translation unit and the host binary needs no -m flags.
+
+#define VK_CAT_(a, b) a##_##b
+#define VK_CAT(a, b) VK_CAT_(a, b)
+#define VK_FN(name) VK_CAT(name, VK_SUFFIX)
+
+#define VK_PRAGMA_(x) _Pragma(#x)
+#define VK_PRAGMA(x) VK_PRAGMA_(x)
+
+#ifdef VK_TARGET
+    #if defined(__clang__)
+        VK_PRAGMA(clang attribute push(__attribute__((target(VK_TARGET))), apply_to = function))
+    #else
+        VK_PRAGMA(GCC push_options)
+        VK_PRAGMA(GCC target(VK_TARGET))
+    #endif
+#endif
+
+// Minimal vector layer. Every ISA provides the same handful of operations on
+// VK_LANES floats (vfloat) and VK_LANES 32-bit phase accumulators (vphase).
+// Phases are unsigned fractions of a cycle, so adding wraps for free.
+#if VK_ISA == VK_ISA_AVX512
+#define VK_LANES 16
+typedef __m512 VK_FN(vfloat);
+typedef __m512i VK_FN(vphase);
+static inline __m512  VK_FN(vf_load)(const float* p)       { return _mm512_load_ps(p); }
+static inline void    VK_FN(vf_store)(float* p, __m512 v)  { _mm512_store_ps(p, v); }
+static inline __m512  VK_FN(vf_set1)(float x)              { return _mm512_set1_ps(x); }
+static inline __m512  VK_FN(vf_add)(__m512 a, __m512 b)    { return _mm512_add_ps(a, b); }
+static inline __m512  VK_FN(vf_mul)(__m512 a, __m512 b)    { return _mm512_mul_ps(a, b); }
+static inline __m512  VK_FN(vf_sub)(__m512 a, __m512 b)    { return _mm512_sub_ps(a, b); }
+static inline __m512  VK_FN(vf_max)(__m512 a, __m512 b)    { return _mm512_max_ps(a, b); }
+static inline __m512  VK_FN(vf_min)(__m512 a, __m512 b)    { return _mm512_min_ps(a, b); }
+static inline __m512  VK_FN(vf_unit)(__m512i ph) { return _mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_srli_epi32(ph, 8)), _mm512_set1_ps(FRAC_SCALE)); }
+static inline __m512i VK_FN(vp_load)(const uint32_t* p)   { return _mm512_load_si512((const void*)p); }
+static inline void    VK_FN(vp_store)(uint32_t* p, __m512i v) { _mm512_store_si512((void*)p, v); }
+static inline __m512i VK_FN(vp_add)(__m512i ph, __m512 inc) { return _mm512_add_epi32(ph, _mm512_cvttps_epi32(inc)); }
+static inline __m512  VK_FN(vf_square)(__m512i ph) {
+    return _mm512_castsi512_ps(_mm512_or_si512(_mm512_andnot_si512(ph, _mm512_set1_epi32((int)0x80000000u)), _mm512_set1_epi32(0x3F800000)));
+}
+static inline __m512i VK_FN(vp_half)(__m512i ph) { return _mm512_add_epi32(ph, _mm512_set1_epi32((int)0x80000000u)); }
+static inline __m512  VK_FN(vf_saw)(__m512i ph) {
+    return _mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_xor_si512(ph, _mm512_set1_epi32((int)0x80000000u))), _mm512_set1_ps(PHASE_TO_SIGNED));
+}
+static inline __m512 VK_FN(vf_table)(const float* table, int bits, __m512i ph) {
+    const __m512i idx = _mm512_srlv_epi32(ph, _mm512_set1_epi32(32 - bits));
+    const __m512 frac = _mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_srli_epi32(_mm512_sllv_epi32(ph, _mm512_set1_epi32(bits)), 8)), _mm512_set1_ps(FRAC_SCALE));
+    const __m512 a = _mm512_i32gather_ps(idx, table, 4);
+    const __m512 b = _mm512_i32gather_ps(idx, table + 1, 4);
+    return _mm512_add_ps(a, _mm512_mul_ps(frac, _mm512_sub_ps(b, a)));
+}
+#elif VK_ISA == VK_ISA_AVX2
+#define VK_LANES 8
+typedef __m256 VK_FN(vfloat);
+typedef __m256i VK_FN(vphase);
+static inline __m256  VK_FN(vf_load)(const float* p)       { return _mm256_load_ps(p); }
+static inline void    VK_FN(vf_store)(float* p, __m256 v)  { _mm256_store_ps(p, v); }
+static inline __m256  VK_FN(vf_set1)(float x)              { return _mm256_set1_ps(x); }
+static inline __m256  VK_FN(vf_add)(__m256 a, __m256 b)    { return _mm256_add_ps(a, b); }
+static inline __m256  VK_FN(vf_mul)(__m256 a, __m256 b)    { return _mm256_mul_ps(a, b); }
+static inline __m256  VK_FN(vf_sub)(__m256 a, __m256 b)    { return _mm256_sub_ps(a, b); }
+static inline __m256  VK_FN(vf_max)(__m256 a, __m256 b)    { return _mm256_max_ps(a, b); }
+static inline __m256  VK_FN(vf_min)(__m256 a, __m256 b)    { return _mm256_min_ps(a, b); }
+static inline __m256  VK_FN(vf_unit)(__m256i ph) { return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(ph, 8)), _mm256_set1_ps(FRAC_SCALE)); }
+static inline __m256i VK_FN(vp_load)(const uint32_t* p)   { return _mm256_load_si256((const __m256i*)p); }
+static inline void    VK_FN(vp_store)(uint32_t* p, __m256i v) { _mm256_store_si256((__m256i*)p, v); }
+static inline __m256i VK_FN(vp_add)(__m256i ph, __m256 inc) { return _mm256_add_epi32(ph, _mm256_cvttps_epi32(inc)); }
+static inline __m256  VK_FN(vf_square)(__m256i ph) {
+    return _mm256_castsi256_ps(_mm256_or_si256(_mm256_andnot_si256(ph, _mm256_set1_epi32((int)0x80000000u)), _mm256_set1_epi32(0x3F800000)));
+}
+static inline __m256i VK_FN(vp_half)(__m256i ph) { return _mm256_add_epi32(ph, _mm256_set1_epi32((int)0x80000000u)); }
+static inline __m256  VK_FN(vf_saw)(__m256i ph) {
+    return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_xor_si256(ph, _mm256_set1_epi32((int)0x80000000u))), _mm256_set1_ps(PHASE_TO_SIGNED));
+}
+static inline __m256 VK_FN(vf_table)(const float* table, int bits, __m256i ph) {
+    const __m256i idx = _mm256_srlv_epi32(ph, _mm256_set1_epi32(32 - bits));
+    const __m256 frac = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(_mm256_sllv_epi32(ph, _mm256_set1_epi32(bits)), 8)), _mm256_set1_ps(FRAC_SCALE));
+    const __m256 a = _mm256_i32gather_ps(table, idx, 4);
+    const __m256 b = _mm256_i32gather_ps(table + 1, idx, 4);
+    return _mm256_add_ps(a, _mm256_mul_ps(frac, _mm256_sub_ps(b, a)));
+}
+#elif VK_ISA == VK_ISA_SSE41
+#define VK_LANES 4
+typedef __m128 VK_FN(vfloat);
+typedef __m128i VK_FN(vphase);
+static inline __m128  VK_FN(vf_load)(const float* p)       { return _mm_load_ps(p); }
+static inline void    VK_FN(vf_store)(float* p, __m128 v)  { _mm_store_ps(p, v); }
+static inline __m128  VK_FN(vf_set1)(float x)              { return _mm_set1_ps(x); }
+static inline __m128  VK_FN(vf_add)(__m128 a, __m128 b)    { return _mm_add_ps(a, b); }
+static inline __m128  VK_FN(vf_mul)(__m128 a, __m128 b)    { return _mm_mul_ps(a, b); }
+static inline __m128  VK_FN(vf_sub)(__m128 a, __m128 b)    { return _mm_sub_ps(a, b); }
+static inline __m128  VK_FN(vf_max)(__m128 a, __m128 b)    { return _mm_max_ps(a, b); }
+static inline __m128  VK_FN(vf_min)(__m128 a, __m128 b)    { return _mm_min_ps(a, b); }
+static inline __m128  VK_FN(vf_unit)(__m128i ph) { return _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(ph, 8)), _mm_set1_ps(FRAC_SCALE)); }
+static inline __m128i VK_FN(vp_load)(const uint32_t* p)   { return _mm_load_si128((const __m128i*)p); }
+static inline void    VK_FN(vp_store)(uint32_t* p, __m128i v) { _mm_store_si128((__m128i*)p, v); }
+static inline __m128i VK_FN(vp_add)(__m128i ph, __m128 inc) { return _mm_add_epi32(ph, _mm_cvttps_epi32(inc)); }
+static inline __m128  VK_FN(vf_square)(__m128i ph) {
+    return _mm_castsi128_ps(_mm_or_si128(_mm_andnot_si128(ph, _mm_set1_epi32((int)0x80000000u)), _mm_set1_epi32(0x3F800000)));
+}
+static inline __m128i VK_FN(vp_half)(__m128i ph) { return _mm_add_epi32(ph, _mm_set1_epi32((int)0x80000000u)); }
+static inline __m128  VK_FN(vf_saw)(__m128i ph) {
+    return _mm_mul_ps(_mm_cvtepi32_ps(_mm_xor_si128(ph, _mm_set1_epi32((int)0x80000000u))), _mm_set1_ps(PHASE_TO_SIGNED));
+}
+static inline __m128 VK_FN(vf_table)(const float* table, int bits, __m128i ph) {
+    const __m128i idx = _mm_srl_epi32(ph, _mm_cvtsi32_si128(32 - bits));
+    const __m128 frac = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(_mm_sll_epi32(ph, _mm_cvtsi32_si128(bits)), 8)), _mm_set1_ps(FRAC_SCALE));
+    const int i0 = _mm_extract_epi32(idx, 0), i1 = _mm_extract_epi32(idx, 1);
+    const int i2 = _mm_extract_epi32(idx, 2), i3 = _mm_extract_epi32(idx, 3);
+    const __m128 a = _mm_setr_ps(table[i0], table[i1], table[i2], table[i3]);
+    const __m128 b = _mm_setr_ps(table[i0 + 1], table[i1 + 1], table[i2 + 1], table[i3 + 1]);
+    return _mm_add_ps(a, _mm_mul_ps(frac, _mm_sub_ps(b, a)));
+}
+#elif VK_ISA == VK_ISA_NEON
+#define VK_LANES 4
+typedef float32x4_t VK_FN(vfloat);
+typedef uint32x4_t VK_FN(vphase);
+static inline float32x4_t VK_FN(vf_load)(const float* p)           { return vld1q_f32(p); }
+static inline void        VK_FN(vf_store)(float* p, float32x4_t v) { vst1q_f32(p, v); }
+static inline float32x4_t VK_FN(vf_set1)(float x)                  { return vdupq_n_f32(x); }
+static inline float32x4_t VK_FN(vf_add)(float32x4_t a, float32x4_t b) { return vaddq_f32(a, b); }
+static inline float32x4_t VK_FN(vf_mul)(float32x4_t a, float32x4_t b) { return vmulq_f32(a, b); }
+static inline float32x4_t VK_FN(vf_sub)(float32x4_t a, float32x4_t b) { return vsubq_f32(a, b); }
+static inline float32x4_t VK_FN(vf_max)(float32x4_t a, float32x4_t b) { return vmaxq_f32(a, b); }
+static inline float32x4_t VK_FN(vf_min)(float32x4_t a, float32x4_t b) { return vminq_f32(a, b); }
+static inline float32x4_t VK_FN(vf_unit)(uint32x4_t ph) { return vmulq_f32(vcvtq_f32_u32(vshrq_n_u32(ph, 8)), vdupq_n_f32(FRAC_SCALE)); }
+static inline uint32x4_t  VK_FN(vp_load)(const uint32_t* p)       { return vld1q_u32(p); }
+static inline void        VK_FN(vp_store)(uint32_t* p, uint32x4_t v) { vst1q_u32(p, v); }
+static inline uint32x4_t  VK_FN(vp_add)(uint32x4_t ph, float32x4_t inc) {
+    return vaddq_u32(ph, vreinterpretq_u32_s32(vcvtq_s32_f32(inc)));
+}
+static inline float32x4_t VK_FN(vf_square)(uint32x4_t ph) {
+    return vreinterpretq_f32_u32(vorrq_u32(vbicq_u32(vdupq_n_u32(0x80000000u), ph), vdupq_n_u32(0x3F800000u)));
+}
+static inline uint32x4_t  VK_FN(vp_half)(uint32x4_t ph) { return vaddq_u32(ph, vdupq_n_u32(0x80000000u)); }
+static inline float32x4_t VK_FN(vf_saw)(uint32x4_t ph) {
+    const int32x4_t centred = vreinterpretq_s32_u32(veorq_u32(ph, vdupq_n_u32(0x80000000u)));
+    return vmulq_f32(vcvtq_f32_s32(centred), vdupq_n_f32(PHASE_TO_SIGNED));
+}
+static inline float32x4_t VK_FN(vf_table)(const float* table, int bits, uint32x4_t ph) {
+    // Shift counts come from a variable, so use the register forms.
+    const uint32x4_t idx = vshlq_u32(ph, vdupq_n_s32(bits - 32));
+    const uint32x4_t low = vshlq_u32(vshlq_u32(ph, vdupq_n_s32(bits)), vdupq_n_s32(-8));
+    const float32x4_t frac = vmulq_f32(vcvtq_f32_u32(low), vdupq_n_f32(FRAC_SCALE));
+    const uint32_t i0 = vgetq_lane_u32(idx, 0), i1 = vgetq_lane_u32(idx, 1);
+    const uint32_t i2 = vgetq_lane_u32(idx, 2), i3 = vgetq_lane_u32(idx, 3);
+    const float la[4] = { table[i0], table[i1], table[i2], table[i3] };
+    const float lb[4] = { table[i0 + 1], table[i1 + 1], table[i2 + 1], table[i3 + 1] };
+    const float32x4_t a = vld1q_f32(la);
+    return vmlaq_f32(a, frac, vsubq_f32(vld1q_f32(lb), a));
+}
+#else
+#define VK_LANES 1
+typedef float VK_FN(vfloat);
+typedef uint32_t VK_FN(vphase);
+static inline float     VK_FN(vf_load)(const float* p)         { return *p; }
+static inline void      VK_FN(vf_store)(float* p, float v)     { *p = v; }
+static inline float     VK_FN(vf_set1)(float x)                { return x; }
+static inline float     VK_FN(vf_add)(float a, float b)        { return a + b; }
+static inline float     VK_FN(vf_mul)(float a, float b)        { return a * b; }
+static inline float     VK_FN(vf_sub)(float a, float b)        { return a - b; }
+static inline float     VK_FN(vf_max)(float a, float b)        { return a > b ? a : b; }
+static inline float     VK_FN(vf_min)(float a, float b)        { return a < b ? a : b; }
+static inline float     VK_FN(vf_unit)(uint32_t ph)           { return phase_unit(ph); }
+static inline uint32_t VK_FN(vp_load)(const uint32_t* p)     { return *p; }
+static inline void      VK_FN(vp_store)(uint32_t* p, uint32_t v) { *p = v; }
+static inline uint32_t VK_FN(vp_add)(uint32_t ph, float inc) { return ph + (uint32_t)(int32_t)inc; }
+static inline float     VK_FN(vf_square)(uint32_t ph)         { return phase_square(ph); }
+static inline uint32_t VK_FN(vp_half)(uint32_t ph)           { return ph + 0x80000000u; }
+static inline float     VK_FN(vf_saw)(uint32_t ph)            { return phase_saw(ph); }
+static inline float     VK_FN(vf_table)(const float* table, int bits, uint32_t ph) { return table_lookup(table, bits, ph); }
+#endif
+
+#if VK_LANES > VOICE_MAX_LANES || MAX_VOICES % VK_LANES != 0
+    #error "voice_kernel.h: VOICE_MAX_LANES/MAX_VOICES too small for this instruction set"
+#endif
+
+// Two-sample PolyBLEP residual for a falling step of 2 at the wrap. With t
+// the phase and idt = 1/dt samples per cycle it is
+// max(0, 1 - t/dt)^2 - max(0, 1 - (1 - t)/dt)^2, which needs no branches.
+static inline VK_FN(vfloat) VK_FN(vf_blep)(VK_FN(vphase) ph, VK_FN(vfloat) idt) {
+    const VK_FN(vfloat) zero = VK_FN(vf_set1)(0.0f), one = VK_FN(vf_set1)(1.0f);
+    const VK_FN(vfloat) t = VK_FN(vf_unit)(ph);
+    const VK_FN(vfloat) lo = VK_FN(vf_max)(zero, VK_FN(vf_sub)(one, VK_FN(vf_mul)(t, idt)));
+    const VK_FN(vfloat) hi = VK_FN(vf_max)(zero, VK_FN(vf_sub)(one, VK_FN(vf_mul)(VK_FN(vf_sub)(one, t), idt)));
+    return VK_FN(vf_sub)(VK_FN(vf_mul)(lo, lo), VK_FN(vf_mul)(hi, hi));
+}
+
+// Band-limited sawtooth: the naive ramp plus the residual at the wrap.
+static inline VK_FN(vfloat) VK_FN(vf_blep_saw)(VK_FN(vphase) ph, VK_FN(vfloat) idt) {
+    return VK_FN(vf_add)(VK_FN(vf_saw)(ph), VK_FN(vf_blep)(ph, idt));
+}
+
+// Band-limited square: the sign-bit square plus the residual at the falling
+// edge (wrap) minus the residual at the rising edge half a cycle later.
+static inline VK_FN(vfloat) VK_FN(vf_blep_square)(VK_FN(vphase) ph, VK_FN(vfloat) idt) {
+    const VK_FN(vfloat) edges = VK_FN(vf_sub)(VK_FN(vf_blep)(ph, idt), VK_FN(vf_blep)(VK_FN(vp_half)(ph), idt));
+    return VK_FN(vf_add)(VK_FN(vf_square)(ph), edges);
+}
+
+// Band-limited triangle, -1 at t = 0 and +1 at t = 1/2: the naive triangle
+// plus a PolyBLAMP residual (1 - |d|)^3 / 6 at each corner, scaled by the
+// slope change there (+-8 per cycle, so 8 dt per sample).
+static inline VK_FN(vfloat) VK_FN(vf_blamp_tri)(VK_FN(vphase) ph, VK_FN(vfloat) dt, VK_FN(vfloat) idt) {
+    const VK_FN(vfloat) zero = VK_FN(vf_set1)(0.0f), one = VK_FN(vf_set1)(1.0f), half = VK_FN(vf_set1)(0.5f);
+    const VK_FN(vfloat) c = VK_FN(vf_sub)(VK_FN(vf_unit)(ph), half);
+    const VK_FN(vfloat) a = VK_FN(vf_max)(c, VK_FN(vf_sub)(zero, c));  // |t - 1/2|
+    const VK_FN(vfloat) r0 = VK_FN(vf_max)(zero, VK_FN(vf_sub)(one, VK_FN(vf_mul)(VK_FN(vf_sub)(half, a), idt)));
+    const VK_FN(vfloat) rh = VK_FN(vf_max)(zero, VK_FN(vf_sub)(one, VK_FN(vf_mul)(a, idt)));
+    const VK_FN(vfloat) blamp = VK_FN(vf_sub)(VK_FN(vf_mul)(VK_FN(vf_mul)(r0, r0), r0), VK_FN(vf_mul)(VK_FN(vf_mul)(rh, rh), rh));
+    const VK_FN(vfloat) tri = VK_FN(vf_sub)(one, VK_FN(vf_mul)(a, VK_FN(vf_set1)(4.0f)));
+    return VK_FN(vf_add)(tri, VK_FN(vf_mul)(VK_FN(vf_mul)(dt, VK_FN(vf_set1)(8.0f / 6.0f)), blamp));
+}
+
+// Evaluate one waveform. table is the sine table for WAVE_SIN and the current
+// mip level for WAVE_TABLE; dt and idt are the phase increment in cycles per
+// sample and its reciprocal, used by the band-limited shapes. wave is a
+// constant in every caller, so the branches fold away.
+static inline VK_FN(vfloat) VK_FN(vf_eval)(WaveType wave, const float* table, VK_FN(vphase) ph,
+                                           VK_FN(vfloat) dt, VK_FN(vfloat) idt) {
+    if (wave == WAVE_SAW) return VK_FN(vf_blep_saw)(ph, idt);
+    if (wave == WAVE_SQU) return VK_FN(vf_blep_square)(ph, idt);
+    if (wave == WAVE_TRI) return VK_FN(vf_blamp_tri)(ph, dt, idt);
+    if (wave == WAVE_TABLE) return VK_FN(vf_table)(table, WT_BITS, ph);
+    return VK_FN(vf_table)(table, TABLE_BITS, ph);
+}
+
+// Table for a run of voices whose largest increment, including modulation,
+// is max_inc: the sine table, or the wavetable level that cannot alias.
+static inline const float* VK_FN(voice_table)(WaveType wave, float max_inc) {
+    if (wave == WAVE_TABLE) return SAW_WAVETABLE[wavetable_level(max_inc)];
+    return SINELUT;
+}
+
+// Advance and evaluate one group of VK_LANES voices for n frames, adding each
+// scaled by its gain and envelope level into its lane of lanes[]. The group
+// keeps its phases in a vector register across the block. max_mod is the
+// block's largest LFO multiplier magnitude in cycles per phase unit.
+static inline __attribute__((always_inline))
+void VK_FN(voice_group)(WaveType wave, uint32_t* phases, const float* incs, const float* gains,
+                        float* levels, const float* coefs, const float* bases,
+                        float max_mod, const float* mod, float* lanes, uint32_t n) {
+    float max_inc = 0.0f;
+    if (wave == WAVE_TABLE) {
+        for (int l = 0; l < VK_LANES; l++) max_inc = incs[l] > max_inc ? incs[l] : max_inc;
+    }
+    const float* table = VK_FN(voice_table)(wave, max_inc * max_mod);
+    VK_FN(vphase) ph = VK_FN(vp_load)(phases);
+    const VK_FN(vfloat) inc = VK_FN(vf_load)(incs);
+    const VK_FN(vfloat) gain = VK_FN(vf_load)(gains);
+    const VK_FN(vfloat) coef = VK_FN(vf_load)(coefs);
+    const VK_FN(vfloat) base = VK_FN(vf_load)(bases);
+    const VK_FN(vfloat) one = VK_FN(vf_set1)(1.0f);
+    VK_FN(vfloat) level = VK_FN(vf_load)(levels);
+    VK_FN(vfloat) dt = VK_FN(vf_set1)(0.0f), idt = dt;
+    if (wave == WAVE_SAW || wave == WAVE_SQU || wave == WAVE_TRI) {
+        VOICE_ALIGN float d[VK_LANES], id[VK_LANES];
+        for (int l = 0; l < VK_LANES; l++) {
+            d[l] = blep_dt(incs[l], mod[0]);
+            id[l] = 1.0f / d[l];
+        }
+        dt = VK_FN(vf_load)(d);
+        idt = VK_FN(vf_load)(id);
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        float* acc = &lanes[i * VK_LANES];
+        const VK_FN(vfloat) out = VK_FN(vf_eval)(wave, table, ph, dt, idt);
+        VK_FN(vf_store)(acc, VK_FN(vf_add)(VK_FN(vf_load)(acc), VK_FN(vf_mul)(out, VK_FN(vf_mul)(gain, level))));
+        ph = VK_FN(vp_add)(ph, VK_FN(vf_mul)(inc, VK_FN(vf_set1)(mod[i])));
+        level = VK_FN(vf_min)(one, VK_FN(vf_add)(VK_FN(vf_mul)(level, coef), base));
+    }
+    VK_FN(vp_store)(phases, ph);
+    VK_FN(vf_store)(levels, level);
+}
+
+// Advance and evaluate voices [0, count) for n frames, adding each scaled by
+// its gain and envelope level into mix. Levels advance by one multiply-add per
+// sample, level = min(level * coef + base, 1), with coef/base fixed for the
+// block; the clamp stops an attack overshooting before its stage ends.
+// incs are in phase units (PHASE_SCALE per cycle) per sample. The
+// band-limited shapes size their corrections from the increment at the start
+// of the block. Voices are processed VK_LANES at a time into per-lane partial
+// sums in lanes[], which are reduced once at the end. Leftover voices run as
+// one more group padded with silent lanes (zero gain, increment and level),
+// so a patch narrower than the vector never drops to scalar code.
+static inline __attribute__((always_inline))
+void VK_FN(voice_loop)(WaveType wave, uint32_t* phases, const float* incs, const float* gains,
+                       float* levels, const float* coefs, const float* bases,
+                       int count, const float* mod, float* mix, uint32_t n) {
+    VOICE_ALIGN float lanes[RENDER_BLOCK_SIZE * VK_LANES];
+    const int groups = count / VK_LANES, rest = count % VK_LANES;
+    if (count == 0) return;
+
+    // A negative multiplier plays the table backwards at its own magnitude,
+    // so the mip level follows the largest |mod|.
+    float max_mod = 0.0f;
+    if (wave == WAVE_TABLE) {
+        for (uint32_t i = 0; i < n; i++) max_mod = fabsf(mod[i]) > max_mod ? fabsf(mod[i]) : max_mod;
+        max_mod *= 1.0f / PHASE_SCALE;
+    }
+
+    for (uint32_t i = 0; i < n; i++) VK_FN(vf_store)(&lanes[i * VK_LANES], VK_FN(vf_set1)(0.0f));
+
+    for (int g = 0; g < groups; g++) {
+        const int k = g * VK_LANES;
+        VK_FN(voice_group)(wave, &phases[k], &incs[k], &gains[k], &levels[k], &coefs[k], &bases[k],
+                           max_mod, mod, lanes, n);
+    }
+
+    if (rest > 0) {
+        const int k = groups * VK_LANES;
+        VOICE_ALIGN uint32_t ph[VK_LANES];
+        VOICE_ALIGN float inc[VK_LANES], gain[VK_LANES], level[VK_LANES], coef[VK_LANES], base[VK_LANES];
+        for (int l = 0; l < VK_LANES; l++) {
+            const int live = l < rest;
+            ph[l] = live ? phases[k + l] : 0;
+            inc[l] = live ? incs[k + l] : 0.0f;
+            gain[l] = live ? gains[k + l] : 0.0f;
+            level[l] = live ? levels[k + l] : 0.0f;
+            coef[l] = live ? coefs[k + l] : 0.0f;
+            base[l] = live ? bases[k + l] : 0.0f;
+        }
+        VK_FN(voice_group)(wave, ph, inc, gain, level, coef, base, max_mod, mod, lanes, n);
+        for (int l = 0; l < rest; l++) {
+            phases[k + l] = ph[l];
+            levels[k + l] = level[l];
+        }
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+        float sum = 0.0f;
+        for (int l = 0; l < VK_LANES; l++) sum += lanes[i * VK_LANES + l];
+        mix[i] += sum;
+    }
+}
+
+// Exported entry point; resolving the waveform here lets the compiler
+// specialise voice_loop for each case.
+static void VK_FN(voice_kernel)(WaveType wave, uint32_t* phases, const float* incs, const float* gains,
+                                float* levels, const float* coefs, const float* bases,
+                                int count, const float* mod, float* mix, uint32_t n) {
+    if (wave == WAVE_SAW)        VK_FN(voice_loop)(WAVE_SAW, phases, incs, gains, levels, coefs, bases, count, mod, mix, n);
+    else if (wave == WAVE_SQU)   VK_FN(voice_loop)(WAVE_SQU, phases, incs, gains, levels, coefs, bases, count, mod, mix, n);
+    else if (wave == WAVE_TRI)   VK_FN(voice_loop)(WAVE_TRI, phases, incs, gains, levels, coefs, bases, count, mod, mix, n);
+    else if (wave == WAVE_TABLE) VK_FN(voice_loop)(WAVE_TABLE, phases, incs, gains, levels, coefs, bases, count, mod, mix, n);
+    else                         VK_FN(voice_loop)(WAVE_SIN, phases, incs, gains, levels, coefs, bases, count, mod, mix, n);
+}
+
+#ifdef VK_TARGET
+    #if defined(__clang__)
+        VK_PRAGMA(clang attribute pop)
+    #else
+        VK_PRAGMA(GCC pop_options)
+    #endif
+#endif
+
+#undef VK_LANES
+#undef VK_PRAGMA
+#undef VK_PRAGMA_
+#undef VK_FN
+#undef VK_CAT
+#undef VK_CAT_
+#undef VK_ISA
+#undef VK_SUFFIX
+#undef VK_TARGET